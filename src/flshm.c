@@ -1,3 +1,8 @@
+#if !defined(_WIN32) && !defined(__APPLE__) && !defined(_GNU_SOURCE)
+	// Required for semtimedop.
+	#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -7,25 +12,42 @@
 	#include <windows.h>
 #elif __APPLE__
 	#include <unistd.h>
+	#include <errno.h>
+	#include <time.h>
+	#include <sched.h>
+	#include <fcntl.h>
+	#include <signal.h>
+	#include <pthread.h>
 	#include <sys/types.h>
 	#include <sys/shm.h>
 	#include <semaphore.h>
 	#include <mach/mach_time.h>
 #else
 	#include <unistd.h>
+	#include <errno.h>
+	#include <time.h>
+	#include <sched.h>
+	#include <signal.h>
+	#include <pthread.h>
 	#include <sys/types.h>
 	#include <sys/shm.h>
 	#include <sys/ipc.h>
 	#include <sys/sem.h>
-	#include <sys/time.h>
-	#include <sys/sysinfo.h>
+	#include <sys/eventfd.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__))
+	// SSE2 and AVX2 scanning, selected at runtime.
+	#define FLSHM_SCAN_X86
+	#include <immintrin.h>
 #endif
 
 #include "flshm.h"
 
 
 // Private functions to read the subset of AMF0 used in the header.
-uint32_t flshm_amf0_read_string(char ** str, char * p, uint32_t max) {
+uint32_t flshm_amf0_read_string(flshm_string * str, char * p, uint32_t max) {
 
 	// Bounds check the header.
 	if (max < 3) {
@@ -52,10 +74,9 @@ uint32_t flshm_amf0_read_string(char ** str, char * p, uint32_t max) {
 		return false;
 	}
 
-	// Copy string to memory, null terminate.
-	*str = malloc(sl + 1);
-	memcpy(*str, p, sl);
-	(*str)[sl] = '\0';
+	// Point to the string in memory, not null terminated.
+	str->data = p;
+	str->size = sl;
 
 	// Return the amout of data read.
 	return size;
@@ -133,10 +154,15 @@ uint32_t flshm_amf0_read_double(double * number, char * p, uint32_t max) {
 
 
 // Private functions to write the subset of AMF0 used in the header.
-uint32_t flshm_amf0_write_string(char * str, char * p, uint32_t max) {
+// Strings are written with the length already known.
+uint32_t flshm_amf0_write_string(
+	const char * str,
+	size_t l,
+	char * p,
+	uint32_t max
+) {
 
-	// Get string length and bounds check.
-	size_t l = strlen(str);
+	// Bounds check.
 	uint16_t sl = l;
 	uint32_t size = l + 3;
 	if (l > 0xFFFF || size > max) {
@@ -226,13 +252,16 @@ uint32_t flshm_amf0_write_double(double number, char * p, uint32_t max) {
 
 
 // Private function to write serialized connection to memory.
-char * flshm_write_connection(char * addr, flshm_connection connection) {
+char * flshm_write_connection(
+	char * addr,
+	flshm_connection connection,
+	uint32_t name_size
+) {
 
 	// Copy the name with the null byte into the list and advance past it.
-	uint32_t name_size = strlen(connection.name);
 	// Only copy name if not pointing to itself.
 	if (addr != connection.name) {
-		strcpy(addr, connection.name);
+		memcpy(addr, connection.name, name_size + 1);
 	}
 	addr += name_size + 1;
 
@@ -266,6 +295,18 @@ uint32_t flshm_hash_uid(uint32_t uid) {
 }
 
 
+// Private function to hash a string, FNV-1a.
+uint32_t flshm_hash_string(const char * str, uint32_t size) {
+
+	uint32_t hash = 0x811C9DC5;
+	for (uint32_t i = 0; i < size; i++) {
+		hash ^= (uint8_t)str[i];
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+
 // Private function to check if sharded memory has been initialized.
 bool flshm_shm_inited(void * shmdata) {
 
@@ -275,6 +316,155 @@ bool flshm_shm_inited(void * shmdata) {
 }
 
 
+// Private function to read a shared word, with acquire ordering.
+uint32_t flshm_load_acquire(char * p) {
+
+#ifdef _MSC_VER
+
+	uint32_t value = *((volatile uint32_t *)p);
+	MemoryBarrier();
+	return value;
+
+#else
+
+	return __atomic_load_n((uint32_t *)p, __ATOMIC_ACQUIRE);
+
+#endif
+
+}
+
+
+// Private function to write a shared word, with release ordering.
+void flshm_store_release(char * p, uint32_t value) {
+
+#ifdef _MSC_VER
+
+	MemoryBarrier();
+	*((volatile uint32_t *)p) = value;
+
+#else
+
+	__atomic_store_n((uint32_t *)p, value, __ATOMIC_RELEASE);
+
+#endif
+
+}
+
+
+// Private function to order all memory accesses before and after it.
+void flshm_fence() {
+
+#ifdef _MSC_VER
+
+	MemoryBarrier();
+
+#else
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+#endif
+
+}
+
+
+// Private function to set bits in a word atomically, returns the old value.
+uint32_t flshm_atomic_or(uint32_t * p, uint32_t value) {
+
+#ifdef _MSC_VER
+
+	return (uint32_t)InterlockedOr((volatile LONG *)p, (LONG)value);
+
+#else
+
+	return __atomic_fetch_or(p, value, __ATOMIC_ACQ_REL);
+
+#endif
+
+}
+
+
+// Private function to swap a word atomically, returns the old value.
+uint32_t flshm_atomic_exchange(uint32_t * p, uint32_t value) {
+
+#ifdef _MSC_VER
+
+	return (uint32_t)InterlockedExchange((volatile LONG *)p, (LONG)value);
+
+#else
+
+	return __atomic_exchange_n(p, value, __ATOMIC_ACQ_REL);
+
+#endif
+
+}
+
+
+// Private function to atomically replace a value if it is still expected.
+bool flshm_atomic_compare_exchange(
+	uint32_t * p,
+	uint32_t expected,
+	uint32_t value
+) {
+
+#ifdef _MSC_VER
+
+	return (uint32_t)InterlockedCompareExchange(
+		(volatile LONG *)p,
+		(LONG)value,
+		(LONG)expected
+	) == expected;
+
+#else
+
+	return __atomic_compare_exchange_n(
+		p,
+		&expected,
+		value,
+		false,
+		__ATOMIC_ACQ_REL,
+		__ATOMIC_RELAXED
+	);
+
+#endif
+
+}
+
+
+// Private function to yield the rest of the thread time slice.
+void flshm_yield() {
+
+#ifdef _WIN32
+
+	SwitchToThread();
+
+#else
+
+	sched_yield();
+
+#endif
+
+}
+
+
+// Private function to sleep the thread for microseconds.
+void flshm_sleep(uint32_t usec) {
+
+#ifdef _WIN32
+
+	Sleep((usec + 999) / 1000);
+
+#else
+
+	struct timespec ts;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000L;
+	nanosleep(&ts, NULL);
+
+#endif
+
+}
+
+
 uint32_t flshm_tick() {
 
 	uint32_t ret;
@@ -292,44 +482,59 @@ uint32_t flshm_tick() {
 
 #else
 
-	// Variables to cache across multiple calls.
-	static bool inited = false;
-	static struct timeval tvbase;
-	static uint32_t base = 0;
+	// Select the clock the first time, same result if racing.
+	// Boot time also counts suspend, like the uptime Flash Player uses.
+	static int selected = 0;
+	int source = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+	struct timespec ts;
+	if (!source) {
+#ifdef CLOCK_BOOTTIME
+		source = clock_gettime(CLOCK_BOOTTIME, &ts) ?
+			CLOCK_MONOTONIC + 1 :
+			CLOCK_BOOTTIME + 1;
+#else
+		source = CLOCK_MONOTONIC + 1;
+#endif
+		__atomic_store_n(&selected, source, __ATOMIC_RELAXED);
+	}
+
+	// Milliseconds of uptime, through the vDSO without a system call.
+	clock_gettime((clockid_t)(source - 1), &ts);
+	ret = (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 
-	if (inited) {
+#endif
 
-		// Get the current time.
-		struct timeval tv;
-		gettimeofday(&tv, 0);
+	return ret;
+}
 
-		// Calculate offset from base.
-		tv.tv_sec -= tvbase.tv_sec;
-		tv.tv_usec -= tvbase.tv_usec;
 
-		// Calculate the tick from the base.
-		ret = base + 1000 * tv.tv_sec + tv.tv_usec / 1000;
-	}
-	else {
+uint32_t flshm_tick_next(flshm_info * info) {
 
-		// Get the system uptime, first time.
-		struct sysinfo si;
-		sysinfo(&si);
+	uint32_t last = flshm_load_acquire((char *)&info->tick);
+	uint32_t tick;
+	do {
 
-		// Get the current time as base.
-		gettimeofday(&tvbase, 0);
+		// Use the current time, unless not after the last, wrapping around.
+		// A last of 0 means none yet, always use the current time then.
+		tick = flshm_tick();
+		if (last && (int32_t)(tick - last) <= 0) {
+			tick = last + 1;
+		}
 
-		// Mark initialized.
-		inited = true;
+		// Skip 0, it means no message.
+		if (!tick) {
+			tick = 1;
+		}
 
-		// Calculate the time base, and use it as first tick.
-		base = 1000 * si.uptime + tvbase.tv_usec / 1000 % 1000;
-		ret = base;
+		// Try again if another thread took a tick meanwhile.
+		if (flshm_atomic_compare_exchange(&info->tick, last, tick)) {
+			break;
+		}
+		last = flshm_load_acquire((char *)&info->tick);
 	}
+	while (true);
 
-#endif
-
-	return ret;
+	return tick;
 }
 
 
@@ -411,6 +616,8 @@ flshm_info * flshm_open(bool is_per_user) {
 	// Everything we need, create info data.
 	info = malloc(sizeof(flshm_info));
 	info->data = (void *)shmaddr;
+	info->index = NULL;
+	info->tick = 0;
 	info->sem = sem;
 	info->shm = shm;
 	info->shmaddr = shmaddr;
@@ -449,6 +656,8 @@ flshm_info * flshm_open(bool is_per_user) {
 	// Everything we need, create info data.
 	info = malloc(sizeof(flshm_info));
 	info->data = (void *)shmaddr;
+	info->index = NULL;
+	info->tick = 0;
 	info->semdesc = semdesc;
 	info->shmid = shmid;
 	info->shmaddr = shmaddr;
@@ -484,6 +693,8 @@ flshm_info * flshm_open(bool is_per_user) {
 	// Everything we need, create info data.
 	info = malloc(sizeof(flshm_info));
 	info->data = (void *)shmaddr;
+	info->index = NULL;
+	info->tick = 0;
 	info->semid = semid;
 	info->shmid = shmid;
 	info->shmaddr = shmaddr;
@@ -577,6 +788,12 @@ void flshm_close(flshm_info * info) {
 
 #endif
 
+	// Free the cached connection list.
+	if (info->index) {
+		free(info->index);
+		info->index = NULL;
+	}
+
 	// Free the memory for the info.
 	free(info);
 }
@@ -605,677 +822,2763 @@ bool flshm_lock(flshm_info * info) {
 }
 
 
-bool flshm_unlock(flshm_info * info) {
+flshm_lock_status flshm_trylock(flshm_info * info) {
 
 #ifdef _WIN32
 
-	return ReleaseMutex(info->sem) == TRUE;
+	DWORD r = WaitForSingleObject(info->sem, 0);
+	if (r == WAIT_OBJECT_0) {
+		return FLSHM_LOCK_ACQUIRED;
+	}
+	return r == WAIT_TIMEOUT ? FLSHM_LOCK_BUSY : FLSHM_LOCK_ERROR;
 
 #elif __APPLE__
 
-	return !sem_post(info->semdesc);
+	if (!sem_trywait(info->semdesc)) {
+		return FLSHM_LOCK_ACQUIRED;
+	}
+	return errno == EAGAIN ? FLSHM_LOCK_BUSY : FLSHM_LOCK_ERROR;
 
 #else
 
 	struct sembuf sb;
 	sb.sem_num = 0;
-	sb.sem_op = 1;
-	sb.sem_flg = SEM_UNDO;
-	return !semop(info->semid, &sb, 1);
+	sb.sem_op = -1;
+	sb.sem_flg = SEM_UNDO | IPC_NOWAIT;
+	if (!semop(info->semid, &sb, 1)) {
+		return FLSHM_LOCK_ACQUIRED;
+	}
+	return errno == EAGAIN ? FLSHM_LOCK_BUSY : FLSHM_LOCK_ERROR;
 
 #endif
 
 }
 
 
-bool flshm_connection_name_valid(const char * name) {
+flshm_lock_status flshm_lock_timed(flshm_info * info, uint32_t timeout) {
 
-	// First character must not be ':'.
-	if (name[0] == ':') {
-		return false;
+#ifdef _WIN32
+
+	DWORD r = WaitForSingleObject(info->sem, timeout);
+	if (r == WAIT_OBJECT_0) {
+		return FLSHM_LOCK_ACQUIRED;
 	}
+	return r == WAIT_TIMEOUT ? FLSHM_LOCK_TIMEOUT : FLSHM_LOCK_ERROR;
 
-	// Check how many colons are expected, and keep track of those seen.
-	uint8_t colons_valid = name[0] == '_' ? 0 : 1;
-	uint8_t colons = 0;
-	for (uint32_t i = 0; true; i++) {
+#elif __APPLE__
 
-		// Check if too large.
-		if (i >= 0xFFFF) {
-			return false;
+	// No sem_timedwait, so poll until the timeout.
+	uint32_t start = flshm_tick();
+	while (true) {
+		if (!sem_trywait(info->semdesc)) {
+			return FLSHM_LOCK_ACQUIRED;
+		}
+		if (errno != EAGAIN && errno != EINTR) {
+			return FLSHM_LOCK_ERROR;
+		}
+		if (flshm_tick() - start >= timeout) {
+			return FLSHM_LOCK_TIMEOUT;
 		}
 
-		char c = name[i];
+		// Sleep for a millisecond before trying again.
+		struct timespec ts;
+		ts.tv_sec = 0;
+		ts.tv_nsec = 1000000L;
+		nanosleep(&ts, NULL);
+	}
 
-		// If null, end of the string.
-		if (c == '\0') {
-			// Must have length and not end in ':'.
-			if (i == 0 || name[i - 1] == ':') {
-				return false;
-			}
-			break;
-		}
+#else
 
-		// If colon, make sure not more than expected.
-		if (c == ':') {
-			if (colons >= colons_valid) {
-				return false;
-			}
-			colons++;
+	struct sembuf sb;
+	sb.sem_num = 0;
+	sb.sem_op = -1;
+	sb.sem_flg = SEM_UNDO;
+
+	// Wait for the remaining time, retry if interrupted.
+	uint32_t start = flshm_tick();
+	uint32_t remaining = timeout;
+	while (true) {
+		struct timespec ts;
+		ts.tv_sec = remaining / 1000;
+		ts.tv_nsec = (remaining % 1000) * 1000000L;
+		if (!semtimedop(info->semid, &sb, 1, &ts)) {
+			return FLSHM_LOCK_ACQUIRED;
 		}
+		if (errno == EAGAIN) {
+			return FLSHM_LOCK_TIMEOUT;
+		}
+		if (errno != EINTR) {
+			return FLSHM_LOCK_ERROR;
+		}
+		uint32_t elapsed = flshm_tick() - start;
+		if (elapsed >= timeout) {
+			return FLSHM_LOCK_TIMEOUT;
+		}
+		remaining = timeout - elapsed;
 	}
 
-	// If saw the expected colon count, return valid.
-	return colons == colons_valid;
+#endif
+
 }
 
 
-flshm_connected flshm_connection_list(flshm_info * info) {
+bool flshm_unlock(flshm_info * info) {
 
-	// Initialize the connected object.
-	flshm_connected connected;
-	connected.count = 0;
+#ifdef _WIN32
 
-	// Initialize a connection struct to all empty values.
-	flshm_connection connection;
-	connection.name = NULL;
-	connection.version = FLSHM_VERSION_1;
-	connection.sandbox = FLSHM_SECURITY_NONE;
+	return ReleaseMutex(info->sem) == TRUE;
 
-	// Map out the memory, and loop over them.
-	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
-	for (uint32_t i = 0; i < FLSHM_CONNECTIONS_SIZE; i++) {
+#elif __APPLE__
 
-		// Get pointer to memory and the character that appears there.
-		char * p = memory + i;
-		char pc = *p;
+	return !sem_post(info->semdesc);
 
-		// Unexpected null byte terminates the list.
-		if (pc == '\0') {
-			break;
-		}
-		else if (pc == ':') {
+#else
 
-			// Check if matches "::[^\x00]\x00" in the remaining space.
-			if (
-				i < FLSHM_CONNECTIONS_SIZE - 3 &&
-				*(p + 1) == ':' &&
-				*(p + 2) != '\0' &&
-				*(p + 3) == '\0'
-			) {
-				// Check that we are still parsing a connection.
-				if (connection.name) {
-					unsigned char c = *(p + 2);
+	struct sembuf sb;
+	sb.sem_num = 0;
+	sb.sem_op = 1;
+	sb.sem_flg = SEM_UNDO;
+	return !semop(info->semid, &sb, 1);
 
-					// Set version then sandbox, '0' then '1' indexed.
-					if (connection.version == FLSHM_VERSION_1) {
-						connection.version = c - (uint8_t)'0';
-					}
-					else if (connection.sandbox == FLSHM_SECURITY_NONE) {
-						connection.sandbox = c - (uint8_t)'1';
-					}
-				}
-				i += 3;
-			}
-			else {
+#endif
 
-				// Otherwise seek until the next null or end.
-				for (; i < FLSHM_CONNECTIONS_SIZE; i++) {
-					if (*(memory + i) == '\0') {
-						break;
-					}
-				}
-			}
-		}
-		else {
+}
 
-			// If currently has an open connection, store it, and reset.
-			if (connection.name) {
-				connected.connections[connected.count++] = connection;
-				connection.name = NULL;
-				connection.version = FLSHM_VERSION_1;
-				connection.sandbox = FLSHM_SECURITY_NONE;
-				// Stop if reached the maximum connections.
-				if (connected.count >= FLSHM_CONNECTIONS_MAX_COUNT) {
-					break;
-				}
-			}
 
-			// Seek out the null in the remaining memory.
-			for (; i < FLSHM_CONNECTIONS_SIZE; i++) {
-				if (*(memory + i) == '\0') {
-					// If nulled and valid, set name.
-					if (flshm_connection_name_valid(p)) {
-						connection.name = p;
-					}
-					break;
-				}
-			}
+// Private function to find the first of 2 characters, one at a time.
+// Returns the offset of the character, or size if not found.
+uint32_t flshm_scan_scalar(const char * p, uint32_t size, char a, char b) {
+
+	for (uint32_t i = 0; i < size; i++) {
+		if (p[i] == a || p[i] == b) {
+			return i;
 		}
 	}
+	return size;
+}
+
 
-	// Store the last connection if not yet stored.
-	if (connection.name) {
-		connected.connections[connected.count++] = connection;
+#ifdef FLSHM_SCAN_X86
+
+// Private function to find the first of 2 characters, 16 at a time.
+__attribute__((target("sse2")))
+uint32_t flshm_scan_sse2(const char * p, uint32_t size, char a, char b) {
+
+	__m128i va = _mm_set1_epi8(a);
+	__m128i vb = _mm_set1_epi8(b);
+
+	// Compare whole blocks, never reading past the size.
+	uint32_t i = 0;
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		uint32_t mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(v, va),
+			_mm_cmpeq_epi8(v, vb)
+		));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
 	}
 
-	return connected;
+	// Finish the remainder one at a time.
+	return i + flshm_scan_scalar(p + i, size - i, a, b);
 }
 
 
-bool flshm_connection_add(flshm_info * info, flshm_connection connection) {
+// Private function to find the first of 2 characters, 32 at a time.
+__attribute__((target("avx2")))
+uint32_t flshm_scan_avx2(const char * p, uint32_t size, char a, char b) {
 
-	// Sanity check the name.
-	if (!connection.name) {
-		return false;
-	}
+	__m256i va = _mm256_set1_epi8(a);
+	__m256i vb = _mm256_set1_epi8(b);
 
-	// Validate the connection name.
-	if (!flshm_connection_name_valid(connection.name)) {
-		return false;
+	// Compare whole blocks, never reading past the size.
+	uint32_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(v, va),
+			_mm256_cmpeq_epi8(v, vb)
+		));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
 	}
 
-	// Get connection name size.
-	uint32_t name_size = strlen(connection.name);
+	// Finish the remainder with the smaller blocks.
+	return i + flshm_scan_sse2(p + i, size - i, a, b);
+}
 
-	// Compute size requirements for serialized connection, includes null.
-	uint32_t serialized_size = name_size + 1;
-	if (connection.version != FLSHM_VERSION_1) {
-		serialized_size += connection.sandbox != FLSHM_SECURITY_NONE ? 8 : 4;
-	}
 
-	// Get the current connections.
-	flshm_connected connected = flshm_connection_list(info);
+// Private function pointer to the scan selected for the CPU.
+uint32_t (* flshm_scan_selected)(const char *, uint32_t, char, char) = NULL;
 
-	// Fail if maxed out on connections.
-	if (connected.count >= FLSHM_CONNECTIONS_MAX_COUNT) {
-		return false;
-	}
+#endif
 
-	// Loop over the connections, make sure the name is unique.
-	for (uint32_t i = 0; i < connected.count; i++) {
-		if (!strcmp(connection.name, connected.connections[i].name)) {
-			return false;
-		}
-	}
 
-	// Seek out end of connection list, if entries are present.
-	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
-	uint32_t offset = 0;
-	if (*memory != '\0') {
-		// Seek for double null, make default offset invalid.
-		offset = 0xFFFFFFFF;
-		for (uint32_t i = 0; i < FLSHM_CONNECTIONS_SIZE - 1; i++) {
-			char * p = memory + i;
-			if (*p == '\0' && *(p + 1) == '\0') {
-				offset = i + 1;
-				break;
-			}
+// Private function to find the first of 2 characters, using SIMD if able.
+// Returns the offset of the character, or size if not found.
+uint32_t flshm_scan(const char * p, uint32_t size, char a, char b) {
+
+#ifdef FLSHM_SCAN_X86
+
+	// Select the best scan the first time, same result if racing.
+	uint32_t (* scan)(const char *, uint32_t, char, char) =
+		__atomic_load_n(&flshm_scan_selected, __ATOMIC_RELAXED);
+	if (!scan) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			scan = flshm_scan_avx2;
 		}
+		else if (__builtin_cpu_supports("sse2")) {
+			scan = flshm_scan_sse2;
+		}
+		else {
+			scan = flshm_scan_scalar;
+		}
+		__atomic_store_n(&flshm_scan_selected, scan, __ATOMIC_RELAXED);
 	}
+	return scan(p, size, a, b);
 
-	// Fail if the serialized data would not fit in the remaining memory.
-	if (
-		offset >= FLSHM_CONNECTIONS_SIZE ||
-		offset + serialized_size + 1 >= FLSHM_CONNECTIONS_SIZE
-	) {
-		return false;
-	}
+#else
 
-	// Write the connection to the list.
-	char * addr = flshm_write_connection(memory + offset, connection);
+	return flshm_scan_scalar(p, size, a, b);
 
-	// Add list terminating null.
-	*(addr + 1) = '\0';
+#endif
 
-	return true;
 }
 
 
-bool flshm_connection_remove(flshm_info * info, flshm_connection connection) {
+// Private type for reading strings a word at a time, aliasing the chars.
+#if defined(__GNUC__) || defined(__clang__)
+	typedef uintptr_t __attribute__((may_alias)) flshm_word;
+#else
+	typedef uintptr_t flshm_word;
+#endif
 
-	// Get the current connections.
-	flshm_connected connected = flshm_connection_list(info);
+// Private attribute for reading the rest of an aligned word past a string.
+// The read never crosses a page, but address sanitizer would report it.
+#if defined(__SANITIZE_ADDRESS__)
+	#define FLSHM_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+	#if __has_feature(address_sanitizer)
+		#define FLSHM_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+	#endif
+#endif
+#ifndef FLSHM_NO_SANITIZE_ADDRESS
+	#define FLSHM_NO_SANITIZE_ADDRESS
+#endif
 
-	// Get the offset of connection list.
-	char * addr = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
 
-	// Loop over them all, rewrite everything to ensure clean reflow.
-	// No overwrite risk, copies will always be written at or before self.
-	bool found = false;
-	for (uint32_t i = 0; i < connected.count; i++) {
-		flshm_connection c = connected.connections[i];
+// Private function to find a character or the null byte, a word at a time.
+// Returns the offset of the character, or max if not found before max.
+FLSHM_NO_SANITIZE_ADDRESS
+uint32_t flshm_scan_string(const char * p, uint32_t max, char a) {
 
-		// Check if this is the one to remove.
-		if (
-			!found &&
-			c.version == connection.version &&
-			c.sandbox == connection.sandbox &&
-			!strcmp(c.name, connection.name)
-		) {
-			found = true;
+	// One at a time until aligned, aligned words never cross a page.
+	uint32_t i = 0;
+	for (; i < max && ((uintptr_t)(p + i) % sizeof(flshm_word)); i++) {
+		if (p[i] == a || p[i] == '\0') {
+			return i;
+		}
+	}
+
+	// A word at a time, until a word has a zero byte, or one matching.
+	flshm_word ones = ((flshm_word)-1) / 0xFF;
+	flshm_word highs = ones * 0x80;
+	flshm_word va = ones * (uint8_t)a;
+	for (; i < max; i += sizeof(flshm_word)) {
+		flshm_word w = *(const flshm_word *)(p + i);
+		flshm_word x = w ^ va;
+		if (((w - ones) & ~w & highs) | ((x - ones) & ~x & highs)) {
+			break;
+		}
+	}
+
+	// Find which byte in that word, one at a time.
+	for (; i < max; i++) {
+		if (p[i] == a || p[i] == '\0') {
+			return i;
+		}
+	}
+	return max;
+}
+
+
+// Private function to check if connection name of known length is valid.
+// Same as flshm_connection_name_valid, but scanning for colons in blocks.
+bool flshm_connection_name_valid_size(const char * name, uint32_t size) {
+
+	// Must have length, not be too large, or start or end with ':'.
+	if (
+		!size ||
+		size >= 0xFFFF ||
+		name[0] == ':' ||
+		name[size - 1] == ':'
+	) {
+		return false;
+	}
+
+	// Global names must have no colons, others exactly one.
+	uint32_t colon = flshm_scan(name, size, ':', ':');
+	if (name[0] == '_') {
+		return colon == size;
+	}
+	return colon < size &&
+		flshm_scan(name + colon + 1, size - colon - 1, ':', ':') ==
+		size - colon - 1;
+}
+
+
+uint32_t flshm_connection_name_length(const char * name) {
+
+	// Find the first colon or the end, if not too large.
+	uint32_t max = 0xFFFF;
+	uint32_t i = flshm_scan_string(name, max, ':');
+	if (i == max) {
+		return 0;
+	}
+
+	// Global names must have no colons, and have length.
+	if (name[0] == '_') {
+		return name[i] == '\0' ? i : 0;
+	}
+
+	// Others exactly one colon, not first or last.
+	if (!i || name[i] != ':') {
+		return 0;
+	}
+	uint32_t j = i + 1 + flshm_scan_string(name + i + 1, max - i - 1, ':');
+	if (j == max || name[j] != '\0' || j == i + 1) {
+		return 0;
+	}
+	return j;
+}
+
+
+bool flshm_connection_name_valid(const char * name) {
+
+	return flshm_connection_name_length(name) != 0;
+}
+
+
+// Private function to parse the next connection entry, from the offset.
+// Advances the offset past the entry, returns false at the end of the list.
+bool flshm_connection_parse_next(
+	char * memory,
+	uint32_t * offset,
+	flshm_connection_entry * entry
+) {
+
+	// Initialize the connection to all empty values.
+	flshm_connection * connection = &entry->connection;
+	connection->name = NULL;
+	connection->version = FLSHM_VERSION_1;
+	connection->sandbox = FLSHM_SECURITY_NONE;
+
+	uint32_t i = *offset;
+	while (i < FLSHM_CONNECTIONS_SIZE) {
+
+		// Get pointer to memory and the character that appears there.
+		char * p = memory + i;
+		char pc = *p;
+
+		// Unexpected null byte terminates the list.
+		if (pc == '\0') {
+			break;
+		}
+		else if (pc == ':') {
+
+			// Check if matches "::[^\x00]\x00" in the remaining space.
+			if (
+				i < FLSHM_CONNECTIONS_SIZE - 3 &&
+				*(p + 1) == ':' &&
+				*(p + 2) != '\0' &&
+				*(p + 3) == '\0'
+			) {
+				// Check that we are still parsing a connection.
+				if (connection->name) {
+					unsigned char c = *(p + 2);
+
+					// Set version then sandbox, '0' then '1' indexed.
+					if (connection->version == FLSHM_VERSION_1) {
+						connection->version = c - (uint8_t)'0';
+					}
+					else if (connection->sandbox == FLSHM_SECURITY_NONE) {
+						connection->sandbox = c - (uint8_t)'1';
+					}
+				}
+				i += 4;
+			}
+			else {
+
+				// Otherwise seek past the next null or to the end.
+				i += flshm_scan(p, FLSHM_CONNECTIONS_SIZE - i, '\0', '\0') + 1;
+			}
+		}
+		else {
+
+			// If currently has an open connection, it ends here.
+			if (connection->name) {
+				break;
+			}
+
+			// Seek out the null in the remaining memory.
+			uint32_t length = flshm_scan(
+				p,
+				FLSHM_CONNECTIONS_SIZE - i,
+				'\0',
+				'\0'
+			);
+
+			// If nulled and valid, set name.
+			if (
+				i + length < FLSHM_CONNECTIONS_SIZE &&
+				flshm_connection_name_valid_size(p, length)
+			) {
+				connection->name = p;
+				entry->offset = i;
+				entry->length = length;
+			}
+			i += length + 1;
+		}
+	}
+
+	// Do not advance past the end.
+	if (i > FLSHM_CONNECTIONS_SIZE) {
+		i = FLSHM_CONNECTIONS_SIZE;
+	}
+	*offset = i;
+
+	// Entry size includes the meta data up to the next entry.
+	if (connection->name) {
+		entry->size = i - entry->offset;
+		return true;
+	}
+	return false;
+}
+
+
+// Private function to parse the connection list in a single pass.
+void flshm_connection_parse(char * memory, flshm_connection_index * index) {
+
+	// Parse entries until the end or the maximum connections.
+	flshm_connected * connected = &index->connected;
+	connected->count = 0;
+	uint32_t i = 0;
+	while (
+		connected->count < FLSHM_CONNECTIONS_MAX_COUNT &&
+		flshm_connection_parse_next(
+			memory,
+			&i,
+			&index->entries[connected->count]
+		)
+	) {
+		connected->connections[connected->count] =
+			index->entries[connected->count].connection;
+		connected->count++;
+	}
+
+	// The list terminating null is where new entries are written, if found.
+	index->end =
+		i < FLSHM_CONNECTIONS_SIZE && memory[i] == '\0' ?
+		i :
+		FLSHM_CONNECTIONS_SIZE;
+}
+
+
+// Private function to get the used size of the connection list, or part.
+// Includes the list terminating null, the double null if any entries.
+uint32_t flshm_connections_used(char * memory, uint32_t size) {
+
+	// Only the terminating null if no entries.
+	if (!size || *memory == '\0') {
+		return size ? 1 : 0;
+	}
+
+	// Seek for double null, else the whole list is used.
+	uint32_t i = 0;
+	while (true) {
+		i += flshm_scan(memory + i, size - 1 - i, '\0', '\0');
+		if (i >= size - 1) {
+			return size;
+		}
+		if (memory[i + 1] == '\0') {
+			return i + 2;
+		}
+		i++;
+	}
+}
+
+
+// Private function to check if the connection list changed since a snapshot.
+// Updates the snapshot if changed.
+bool flshm_connections_snapshot_update(
+	flshm_connections_snapshot * snapshot,
+	char * memory
+) {
+
+	// Unchanged if the used memory still matches, terminating null included.
+	if (snapshot->size && !memcmp(snapshot->data, memory, snapshot->size)) {
+		return false;
+	}
+
+	// Copy the used memory.
+	uint32_t size = flshm_connections_used(memory, FLSHM_CONNECTIONS_SIZE);
+	memcpy(snapshot->data, memory, size);
+	snapshot->size = size;
+	return true;
+}
+
+
+// Private function to get the cached connection list, parsed if changed.
+flshm_connection_index * flshm_connection_index_get(flshm_info * info) {
+
+	// Map out the memory.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+
+	// Create the cache the first time.
+	if (!info->index) {
+		info->index = malloc(sizeof(flshm_connection_index));
+		info->index->snapshot.size = 0;
+	}
+
+	// Parse again only if the memory changed since last parsed.
+	flshm_connection_index * index = info->index;
+	if (flshm_connections_snapshot_update(&index->snapshot, memory)) {
+		flshm_connection_parse(memory, index);
+	}
+
+	return index;
+}
+
+
+flshm_connected flshm_connection_list(flshm_info * info) {
+
+	return flshm_connection_index_get(info)->connected;
+}
+
+
+bool flshm_connection_find(
+	flshm_info * info,
+	const char * name,
+	flshm_connection_entry * entry
+) {
+
+	// Map out the memory.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+	uint32_t name_size = strlen(name);
+
+	// Parse entries until a match, the end, or the maximum connections.
+	uint32_t i = 0;
+	for (uint32_t count = 0; count < FLSHM_CONNECTIONS_MAX_COUNT; count++) {
+		if (!flshm_connection_parse_next(memory, &i, entry)) {
+			break;
+		}
+
+		// Compare the lengths first, then the names.
+		if (
+			entry->length == name_size &&
+			!memcmp(entry->connection.name, name, name_size)
+		) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+bool flshm_connection_add(flshm_info * info, flshm_connection connection) {
+
+	// Add as a batch of one.
+	flshm_connection_status status;
+	return flshm_connection_add_many(info, &connection, 1, &status) == 1;
+}
+
+
+uint32_t flshm_connection_add_many(
+	flshm_info * info,
+	const flshm_connection * connections,
+	uint32_t count,
+	flshm_connection_status * statuses
+) {
+
+	// Get the current connections, and where the list ends.
+	flshm_connection_index * index = flshm_connection_index_get(info);
+	uint32_t listed = index->connected.count;
+
+	// Write at the end of the connection list.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+	uint32_t offset = index->end;
+
+	// Keep track of the names being added, to check them for uniqueness too.
+	uint32_t added[FLSHM_CONNECTIONS_MAX_COUNT];
+	uint32_t added_sizes[FLSHM_CONNECTIONS_MAX_COUNT];
+	uint32_t added_count = 0;
+
+	// Check each connection, and compute where each would be written.
+	for (uint32_t i = 0; i < count; i++) {
+		flshm_connection connection = connections[i];
+
+		// Sanity check and validate the connection name, getting its size.
+		uint32_t name_size = connection.name ?
+			flshm_connection_name_length(connection.name) :
+			0;
+		if (!name_size) {
+			statuses[i] = FLSHM_CONNECTION_INVALID;
+			continue;
+		}
+
+		// Fail if maxed out on connections.
+		if (listed + added_count >= FLSHM_CONNECTIONS_MAX_COUNT) {
+			statuses[i] = FLSHM_CONNECTION_FULL;
+			continue;
+		}
+
+		// Loop over the connections, make sure the name is unique.
+		bool unique = true;
+		for (uint32_t j = 0; unique && j < listed; j++) {
+			flshm_connection_entry * entry = &index->entries[j];
+			unique = !(
+				entry->length == name_size &&
+				!memcmp(connection.name, entry->connection.name, name_size)
+			);
+		}
+		for (uint32_t j = 0; unique && j < added_count; j++) {
+			unique = !(
+				added_sizes[j] == name_size &&
+				!memcmp(connection.name, connections[added[j]].name, name_size)
+			);
+		}
+		if (!unique) {
+			statuses[i] = FLSHM_CONNECTION_DUPLICATE;
+			continue;
+		}
+
+		// Compute size requirements for serialized connection, includes null.
+		uint32_t serialized_size = name_size + 1;
+		if (connection.version != FLSHM_VERSION_1) {
+			serialized_size +=
+				connection.sandbox != FLSHM_SECURITY_NONE ? 8 : 4;
+		}
+
+		// Fail if the serialized data would not fit in the remaining memory.
+		if (
+			offset >= FLSHM_CONNECTIONS_SIZE ||
+			offset + serialized_size + 1 >= FLSHM_CONNECTIONS_SIZE
+		) {
+			statuses[i] = FLSHM_CONNECTION_NO_SPACE;
 			continue;
 		}
 
-		// Rewrite this connection wherever earlier it may fall.
-		addr = flshm_write_connection(addr, c);
-	}
+		statuses[i] = FLSHM_CONNECTION_ADDED;
+		added[added_count] = i;
+		added_sizes[added_count] = name_size;
+		added_count++;
+		offset += serialized_size;
+	}
+
+	// Append all the connections to the list at once, if any.
+	if (added_count) {
+		char * addr = memory + index->end;
+		for (uint32_t i = 0; i < added_count; i++) {
+			addr = flshm_write_connection(
+				addr,
+				connections[added[i]],
+				added_sizes[i]
+			);
+		}
+
+		// Add list terminating null.
+		*(addr + 1) = '\0';
+	}
+
+	return added_count;
+}
+
+
+bool flshm_connection_remove_entry(
+	flshm_info * info,
+	const flshm_connection_entry * entry
+) {
+
+	// Sanity check the entry is inside the list.
+	if (
+		!entry->size ||
+		entry->offset >= FLSHM_CONNECTIONS_SIZE ||
+		entry->size > FLSHM_CONNECTIONS_SIZE - entry->offset
+	) {
+		return false;
+	}
+
+	// Map out the memory.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+	uint32_t end = entry->offset + entry->size;
+
+	// Move only the rest of the list back over it, the terminating null too.
+	uint32_t tail = flshm_connections_used(
+		memory + end,
+		FLSHM_CONNECTIONS_SIZE - end
+	);
+	memmove(memory + entry->offset, memory + end, tail);
+
+	// Clear the memory left behind after the end of the list.
+	memset(memory + entry->offset + tail, 0, entry->size);
+
+	return true;
+}
+
+
+bool flshm_connection_remove(flshm_info * info, flshm_connection connection) {
+
+	// Map out the memory.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+	uint32_t name_size = strlen(connection.name);
+
+	// Find the connection to remove, stopping at the first match.
+	flshm_connection_entry entry;
+	uint32_t i = 0;
+	bool found = false;
+	for (uint32_t count = 0; count < FLSHM_CONNECTIONS_MAX_COUNT; count++) {
+		if (!flshm_connection_parse_next(memory, &i, &entry)) {
+			break;
+		}
+		flshm_connection c = entry.connection;
+		if (
+			c.version == connection.version &&
+			c.sandbox == connection.sandbox &&
+			entry.length == name_size &&
+			!memcmp(c.name, connection.name, name_size)
+		) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		return false;
+	}
+
+	return flshm_connection_remove_entry(info, &entry);
+}
+
+
+uint32_t flshm_message_tick(flshm_info * info) {
+
+	// Read the tick from the memory.
+	return *((uint32_t *)((char *)info->data + FLSHM_MESSAGE_TICK_OFFSET));
+}
+
+
+uint32_t flshm_message_pending(flshm_info * info) {
+
+	// Pointer to shared memory.
+	char * shmdata = (char *)info->data;
+
+	// Read the tick first, it is published last.
+	uint32_t tick = flshm_load_acquire(shmdata + FLSHM_MESSAGE_TICK_OFFSET);
+	if (!tick) {
+		return 0;
+	}
+
+	// Sanity check the size, a message without a valid size is not pending.
+	uint32_t amfl = flshm_load_acquire(shmdata + FLSHM_MESSAGE_SIZE_OFFSET);
+	if (!amfl || amfl > FLSHM_MESSAGE_MAX_SIZE) {
+		return 0;
+	}
+
+	return tick;
+}
+
+
+void flshm_message_free(flshm_message * message) {
+
+	// Free any and all memory associated with the message structure.
+	if (message->name) {
+		free(message->name);
+	}
+	if (message->host) {
+		free(message->host);
+	}
+	if (message->filepath) {
+		free(message->filepath);
+	}
+	if (message->method) {
+		free(message->method);
+	}
+	if (message->data) {
+		free(message->data);
+	}
+
+	// Then free the message structure itself.
+	free(message);
+}
+
+
+// Private function to copy a string view to a null terminated string.
+char * flshm_string_copy(flshm_string str) {
+
+	// Not present strings remain NULL.
+	if (!str.data) {
+		return NULL;
+	}
+
+	char * copy = malloc(str.size + 1);
+	memcpy(copy, str.data, str.size);
+	copy[str.size] = '\0';
+	return copy;
+}
+
+
+// Private function to parse the message in shared memory into a view.
+bool flshm_message_parse(char * shmdata, flshm_message_view * view) {
+
+	double d2i;
+
+	// Read the tick count and check if set (only valid if non-zero).
+	uint32_t tick = *((uint32_t *)(shmdata + FLSHM_MESSAGE_TICK_OFFSET));
+	if (!tick) {
+		return false;
+	}
+
+	// Read the message size if present and sanity check it.
+	uint32_t amfl = *((uint32_t *)(shmdata + FLSHM_MESSAGE_SIZE_OFFSET));
+	if (!amfl || amfl > FLSHM_MESSAGE_MAX_SIZE) {
+		return false;
+	}
+
+	// Initialize all the properties, some are optional.
+	view->tick = tick;
+	view->amfl = amfl;
+	view->version = FLSHM_VERSION_1;
+	view->sandboxed = false;
+	view->https = false;
+	view->sandbox = 0;
+	view->swfv = 0;
+	view->filepath.data = NULL;
+	view->filepath.size = 0;
+	view->amfv = FLSHM_AMF0;
+
+	// Keep track of position and bounds.
+	uint32_t i = FLSHM_MESSAGE_BODY_OFFSET;
+	uint32_t max = FLSHM_MESSAGE_BODY_OFFSET + amfl;
+	uint32_t read;
+
+	// Read the connection name, or fail.
+	if (!(read = flshm_amf0_read_string(
+		&view->name,
+		shmdata + i,
+		max - i
+	))) {
+		return false;
+	}
+	i += read;
+
+	// Read the host name, or fail.
+	if (!(read = flshm_amf0_read_string(
+		&view->host,
+		shmdata + i,
+		max - i
+	))) {
+		return false;
+	}
+	i += read;
+
+	// Read the optional data, if present, based on first boolean.
+
+	// Read version 2 data if present.
+	if ((read = flshm_amf0_read_boolean(
+		&view->sandboxed,
+		shmdata + i,
+		max - i
+	))) {
+		// Read sandboxed successfully.
+		i += read;
+
+		// We have version 2 at least, read data.
+		view->version = FLSHM_VERSION_2;
+
+		// Read HTTPS or fail.
+		if (!(read = flshm_amf0_read_boolean(
+			&view->https,
+			shmdata + i,
+			max - i
+		))) {
+			return false;
+		}
+		i += read;
+
+		// Read version 3 data if present, based on first double.
+		if ((read = flshm_amf0_read_double(
+			&d2i,
+			shmdata + i,
+			max - i
+		))) {
+			// Read sandbox successfully.
+			view->sandbox = (int32_t)d2i;
+			i += read;
+
+			// We have version 3 at least, read data.
+			view->version = FLSHM_VERSION_3;
+
+			// Read version or fail.
+			if (!(read = flshm_amf0_read_double(
+				&d2i,
+				shmdata + i,
+				max - i
+			))) {
+				return false;
+			}
+			view->swfv = (uint32_t)d2i;
+			i += read;
+
+			// If sandbox local-with-file, includes sender filepath.
+			if (view->sandbox == FLSHM_SECURITY_LOCAL_WITH_FILE) {
+				if (!(read = flshm_amf0_read_string(
+					&view->filepath,
+					shmdata + i,
+					max - i
+				))) {
+					return false;
+				}
+				i += read;
+			}
+
+			// Read AMF version if present, else ignore.
+			if ((read = flshm_amf0_read_double(
+				&d2i,
+				shmdata + i,
+				max - i
+			))) {
+				view->amfv = (uint32_t)d2i;
+				i += read;
+
+				// Version must be 4.
+				view->version = FLSHM_VERSION_4;
+			}
+		}
+	}
+
+	// Read the method name or fail.
+	if (!(read = flshm_amf0_read_string(
+		&view->method,
+		shmdata + i,
+		max - i
+	))) {
+		return false;
+	}
+	i += read;
+
+	// The remaining data is the message arguments.
+	view->size = max - i;
+	view->data = shmdata + i;
+
+	return true;
+}
+
+
+// Private function to check if the message is sent to one of the names.
+// Only reads the name string header, without decoding the message.
+bool flshm_message_addressed(
+	char * shmdata,
+	const char ** names,
+	uint32_t count
+) {
+
+	// Check that a message is set.
+	if (!*((uint32_t *)(shmdata + FLSHM_MESSAGE_TICK_OFFSET))) {
+		return false;
+	}
+
+	// Read the message size if present and sanity check it.
+	uint32_t amfl = *((uint32_t *)(shmdata + FLSHM_MESSAGE_SIZE_OFFSET));
+	if (!amfl || amfl > FLSHM_MESSAGE_MAX_SIZE) {
+		return false;
+	}
+
+	// Read the connection name in place, or fail.
+	flshm_string name;
+	if (!flshm_amf0_read_string(
+		&name,
+		shmdata + FLSHM_MESSAGE_BODY_OFFSET,
+		amfl
+	)) {
+		return false;
+	}
+
+	// Compare the lengths first, then the names.
+	for (uint32_t i = 0; i < count; i++) {
+		if (
+			strlen(names[i]) == name.size &&
+			!memcmp(names[i], name.data, name.size)
+		) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+flshm_message * flshm_message_read(flshm_info * info) {
+
+	// Parse the message without copying anything, or fail.
+	flshm_message_view view;
+	if (!flshm_message_parse((char *)info->data, &view)) {
+		return NULL;
+	}
+
+	// Everything needed, allocate the struct and copy the data.
+	flshm_message * message = malloc(sizeof(flshm_message));
+
+	message->tick = view.tick;
+	message->amfl = view.amfl;
+	message->name = flshm_string_copy(view.name);
+	message->host = flshm_string_copy(view.host);
+	message->version = view.version;
+	message->sandboxed = view.sandboxed;
+	message->https = view.https;
+	message->sandbox = view.sandbox;
+	message->swfv = view.swfv;
+	message->filepath = flshm_string_copy(view.filepath);
+	message->amfv = view.amfv;
+	message->method = flshm_string_copy(view.method);
+	message->size = view.size;
+	message->data = NULL;
+	if (view.size) {
+		message->data = malloc(view.size);
+		memcpy(message->data, view.data, view.size);
+	}
+
+	return message;
+}
+
+
+bool flshm_message_read_view(flshm_info * info, flshm_message_view * view) {
+
+	// Parse the message pointing directly into the shared memory.
+	return flshm_message_parse((char *)info->data, view);
+}
+
+
+flshm_message * flshm_message_read_for(
+	flshm_info * info,
+	const char ** names,
+	uint32_t count
+) {
+
+	// Skip decoding if not sent to one of the names.
+	if (!flshm_message_addressed((char *)info->data, names, count)) {
+		return NULL;
+	}
+
+	return flshm_message_read(info);
+}
+
+
+flshm_wait_strategy flshm_wait_strategy_default() {
+
+	flshm_wait_strategy strategy;
+	strategy.spins = 64;
+	strategy.yields = 16;
+	strategy.sleep_min = 50;
+	strategy.sleep_max = 10000;
+	return strategy;
+}
+
+
+// Private function to wait before polling again.
+// Spins, then yields, then sleeps, without sleeping past the remaining ms.
+void flshm_backoff(
+	const flshm_wait_strategy * strategy,
+	uint32_t polls,
+	uint32_t * sleep,
+	uint32_t remaining
+) {
+
+	if (polls >= strategy->spins + strategy->yields) {
+		uint32_t usec = *sleep;
+		if ((uint64_t)usec > (uint64_t)remaining * 1000) {
+			usec = remaining * 1000;
+		}
+		flshm_sleep(usec);
+		if (*sleep < strategy->sleep_max) {
+			*sleep = *sleep * 2 < strategy->sleep_max ?
+				*sleep * 2 :
+				strategy->sleep_max;
+		}
+	}
+	else if (polls >= strategy->spins) {
+		flshm_yield();
+	}
+}
+
+
+uint32_t flshm_message_wait(
+	flshm_info * info,
+	const flshm_message_filter * filter,
+	uint32_t deadline,
+	const flshm_wait_strategy * strategy,
+	uint32_t * wakeups
+) {
+
+	// Use the default strategy if not specified.
+	flshm_wait_strategy defaults;
+	if (!strategy) {
+		defaults = flshm_wait_strategy_default();
+		strategy = &defaults;
+	}
+
+	// Pointer to shared memory.
+	char * shmdata = (char *)info->data;
+
+	// Remember the last tick checked that did not match.
+	uint32_t ignore = filter ? filter->ignore : 0;
+
+	uint32_t polls = 0;
+	uint32_t sleep = strategy->sleep_min;
+	uint32_t tick = 0;
+	while (true) {
+
+		// Check for a new message, and if it matches the filter.
+		uint32_t pending = flshm_message_pending(info);
+		if (pending && pending != ignore) {
+			if (
+				!filter ||
+				!filter->names ||
+				flshm_message_addressed(shmdata, filter->names, filter->count)
+			) {
+				tick = pending;
+				break;
+			}
+			ignore = pending;
+		}
+
+		// Stop if the deadline has passed.
+		int32_t remaining = (int32_t)(deadline - flshm_tick());
+		if (remaining <= 0) {
+			break;
+		}
+
+		flshm_backoff(strategy, polls, &sleep, (uint32_t)remaining);
+		polls++;
+	}
+
+	if (wakeups) {
+		*wakeups = polls;
+	}
+	return tick;
+}
+
+
+// Private function to copy a string view into a buffer, null terminated.
+char * flshm_string_copy_to(flshm_string str, char ** buffer) {
+
+	// Not present strings remain NULL.
+	if (!str.data) {
+		return NULL;
+	}
+
+	char * copy = *buffer;
+	memcpy(copy, str.data, str.size);
+	copy[str.size] = '\0';
+	*buffer += str.size + 1;
+	return copy;
+}
+
+
+flshm_reader * flshm_reader_create() {
+
+	flshm_reader * reader = malloc(sizeof(flshm_reader));
+
+	// Room for the largest message, plus null bytes for the 4 strings.
+	reader->buffer_size = FLSHM_MESSAGE_MAX_SIZE + 4;
+	reader->buffer = malloc(reader->buffer_size);
+
+	return reader;
+}
+
+
+void flshm_reader_free(flshm_reader * reader) {
+
+	// Free the buffer, then the reader itself.
+	free(reader->buffer);
+	free(reader);
+}
+
+
+flshm_message * flshm_reader_read(flshm_reader * reader, flshm_info * info) {
+
+	// Parse the message without copying anything, or fail.
+	flshm_message_view view;
+	if (!flshm_message_parse((char *)info->data, &view)) {
+		return NULL;
+	}
+
+	// Grow the buffer if the data and null bytes would not fit.
+	uint32_t buffer_size = view.amfl + 4;
+	if (buffer_size > reader->buffer_size) {
+		free(reader->buffer);
+		reader->buffer = malloc(buffer_size);
+		reader->buffer_size = buffer_size;
+	}
+
+	// Reset the buffer and copy everything into it.
+	char * buffer = reader->buffer;
+	flshm_message * message = &reader->message;
+
+	message->tick = view.tick;
+	message->amfl = view.amfl;
+	message->name = flshm_string_copy_to(view.name, &buffer);
+	message->host = flshm_string_copy_to(view.host, &buffer);
+	message->version = view.version;
+	message->sandboxed = view.sandboxed;
+	message->https = view.https;
+	message->sandbox = view.sandbox;
+	message->swfv = view.swfv;
+	message->filepath = flshm_string_copy_to(view.filepath, &buffer);
+	message->amfv = view.amfv;
+	message->method = flshm_string_copy_to(view.method, &buffer);
+	message->size = view.size;
+	message->data = NULL;
+	if (view.size) {
+		message->data = buffer;
+		memcpy(buffer, view.data, view.size);
+	}
+
+	return message;
+}
+
+
+flshm_message * flshm_reader_read_for(
+	flshm_reader * reader,
+	flshm_info * info,
+	const char ** names,
+	uint32_t count
+) {
+
+	// Skip decoding if not sent to one of the names.
+	if (!flshm_message_addressed((char *)info->data, names, count)) {
+		return NULL;
+	}
+
+	return flshm_reader_read(reader, info);
+}
+
+
+// Private struct for the string lengths measured while sizing a header.
+typedef struct flshm_message_lengths {
+	uint32_t name;
+	uint32_t host;
+	uint32_t filepath;
+} flshm_message_lengths;
+
+
+// Private function to validate and compute the size of the message header.
+// The header is everything before the method, returns 0 if invalid.
+// The string lengths are kept for encoding, to only measure once.
+uint32_t flshm_message_header_size(
+	flshm_message * message,
+	flshm_message_lengths * lengths
+) {
+
+	// Validate connection is set and valid.
+	if (!message->name) {
+		return 0;
+	}
+	lengths->name = flshm_connection_name_length(message->name);
+	if (!lengths->name) {
+		return 0;
+	}
+	// Validate host is set and valid.
+	if (!message->host) {
+		return 0;
+	}
+	size_t host_size = strlen(message->host);
+	if (host_size > 0xFFFF) {
+		return 0;
+	}
+	lengths->host = host_size;
+	lengths->filepath = 0;
+
+	// The connection name and host strings.
+	uint32_t size = lengths->name + 3 + host_size + 3;
+
+	// Add version 2 data if specified, the 2 booleans.
+	if (message->version >= FLSHM_VERSION_2) {
+		size += 4;
+
+		// Add version 3 data if specified, the 2 doubles.
+		if (message->version >= FLSHM_VERSION_3) {
+			size += 18;
+
+			// If local-with-file sandbox, ensure filepath is set and valid.
+			if (message->sandbox == FLSHM_SECURITY_LOCAL_WITH_FILE) {
+				if (!message->filepath) {
+					return 0;
+				}
+				size_t filepath_size = strlen(message->filepath);
+				if (filepath_size > 0xFFFF) {
+					return 0;
+				}
+				lengths->filepath = filepath_size;
+
+				// Only written if also sandboxed.
+				if (message->sandboxed) {
+					size += filepath_size + 3;
+				}
+			}
+
+			// Add version 4 data if specified, the AMF version double.
+			if (message->version >= FLSHM_VERSION_4) {
+				size += 9;
+			}
+		}
+	}
+
+	return size;
+}
+
+
+// Private function to encode the message header, previously validated.
+// Returns the pointer after the encoded data.
+char * flshm_message_header_encode(
+	flshm_message * message,
+	const flshm_message_lengths * lengths,
+	char * p
+) {
+
+	// The size was already computed, so encoding cannot fail.
+	uint32_t max = FLSHM_MESSAGE_MAX_SIZE;
+
+	// Write the connection name and host.
+	p += flshm_amf0_write_string(message->name, lengths->name, p, max);
+	p += flshm_amf0_write_string(message->host, lengths->host, p, max);
+
+	// Add version 2 data if specified.
+	if (message->version >= FLSHM_VERSION_2) {
+
+		// Write sandboxed and HTTPS.
+		p += flshm_amf0_write_boolean(message->sandboxed, p, max);
+		p += flshm_amf0_write_boolean(message->https, p, max);
+
+		// Add version 3 data if specified.
+		if (message->version >= FLSHM_VERSION_3) {
+
+			// Write sandbox and version.
+			p += flshm_amf0_write_double((double)message->sandbox, p, max);
+			p += flshm_amf0_write_double((double)message->swfv, p, max);
+
+			// Write filepath if local-with-file.
+			if (
+				message->sandboxed &&
+				message->sandbox == FLSHM_SECURITY_LOCAL_WITH_FILE
+			) {
+				p += flshm_amf0_write_string(
+					message->filepath,
+					lengths->filepath,
+					p,
+					max
+				);
+			}
+
+			// Add version 4 data if specified, the AMF version.
+			if (message->version >= FLSHM_VERSION_4) {
+				p += flshm_amf0_write_double((double)message->amfv, p, max);
+			}
+		}
+	}
+
+	return p;
+}
+
+
+// Private function to retract the current message before writing a new one.
+// Readers polling without the lock see the tick cleared before any new data.
+char * flshm_message_retract(flshm_info * info) {
+
+	// Pointer to shared memory.
+	char * shmdata = (char *)info->data;
+
+	// Clear the tick first, fenced so the body stores cannot move before it.
+	// A release store alone only orders the accesses before it.
+	flshm_store_release(shmdata + FLSHM_MESSAGE_TICK_OFFSET, 0);
+	flshm_fence();
+
+	// Return where to write the body.
+	return shmdata + FLSHM_MESSAGE_BODY_OFFSET;
+}
+
+
+// Private function to publish the message written to shared memory.
+void flshm_message_publish(flshm_info * info, uint32_t tick, uint32_t amfl) {
+
+	// Pointer to shared memory.
+	char * shmdata = (char *)info->data;
+
+	// Set the size of the message, then the tick last once complete.
+	flshm_store_release(shmdata + FLSHM_MESSAGE_SIZE_OFFSET, amfl);
+	flshm_store_release(shmdata + FLSHM_MESSAGE_TICK_OFFSET, tick);
+}
+
+
+// Private function to validate and compute the total size of the message.
+// Adds the method and data fragments to the header size, 0 if invalid.
+// The method length is kept for writing, to only measure once.
+uint32_t flshm_message_body_size(
+	uint32_t header_size,
+	uint32_t tick,
+	const char * method,
+	uint32_t * method_length,
+	const flshm_iovec * iov,
+	uint32_t iovcnt
+) {
+
+	// Validate tick is non-0.
+	if (!tick) {
+		return 0;
+	}
+	// Validate method is set and valid.
+	if (!method) {
+		return 0;
+	}
+	size_t method_size = strlen(method);
+	if (method_size > 0xFFFF) {
+		return 0;
+	}
+	*method_length = method_size;
+
+	// Compute the total size, and check that message data will fit.
+	uint32_t size = header_size + method_size + 3;
+	if (size > FLSHM_MESSAGE_MAX_SIZE) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < iovcnt; i++) {
+		if (iov[i].size > FLSHM_MESSAGE_MAX_SIZE - size) {
+			return 0;
+		}
+		size += iov[i].size;
+	}
+
+	return size;
+}
+
+
+// Private function to write the method and data fragments, then publish.
+void flshm_message_body_write(
+	flshm_info * info,
+	char * p,
+	uint32_t tick,
+	uint32_t amfl,
+	const char * method,
+	uint32_t method_length,
+	const flshm_iovec * iov,
+	uint32_t iovcnt
+) {
+
+	// Write the method, then copy each fragment in order.
+	p += flshm_amf0_write_string(
+		method,
+		method_length,
+		p,
+		FLSHM_MESSAGE_MAX_SIZE
+	);
+	for (uint32_t i = 0; i < iovcnt; i++) {
+		if (iov[i].size) {
+			memcpy(p, iov[i].data, iov[i].size);
+			p += iov[i].size;
+		}
+	}
+
+	// Publish the size and tick.
+	flshm_message_publish(info, tick, amfl);
+}
+
+
+bool flshm_message_write(flshm_info * info, flshm_message * message) {
+
+	// Write the message data as a single fragment.
+	flshm_iovec iov;
+	iov.data = message->data;
+	iov.size = message->size;
+	return flshm_message_writev(info, message, &iov, 1);
+}
+
+
+bool flshm_message_writev(
+	flshm_info * info,
+	flshm_message * message,
+	const flshm_iovec * iov,
+	uint32_t iovcnt
+) {
+
+	// Validate the header and get the encoded size.
+	flshm_message_lengths lengths;
+	uint32_t header_size = flshm_message_header_size(message, &lengths);
+	if (!header_size) {
+		return false;
+	}
+
+	// Compute the total size up front, or fail if invalid or too large.
+	uint32_t method_length;
+	uint32_t size = flshm_message_body_size(
+		header_size,
+		message->tick,
+		message->method,
+		&method_length,
+		iov,
+		iovcnt
+	);
+	if (!size) {
+		return false;
+	}
+
+	// Encode directly into shared memory, can no longer fail.
+	char * p = flshm_message_retract(info);
+	p = flshm_message_header_encode(message, &lengths, p);
+
+	// Set the total AMF size on the struct.
+	message->amfl = size;
+
+	// Write the method and data, and publish.
+	flshm_message_body_write(
+		info,
+		p,
+		message->tick,
+		size,
+		message->method,
+		method_length,
+		iov,
+		iovcnt
+	);
+
+	return true;
+}
+
+
+flshm_sender * flshm_sender_create(flshm_message * message) {
+
+	// Validate the header and get the encoded size.
+	flshm_message_lengths lengths;
+	uint32_t header_size = flshm_message_header_size(message, &lengths);
+	if (!header_size || header_size > FLSHM_MESSAGE_MAX_SIZE - 3) {
+		return NULL;
+	}
+
+	// Encode the header once.
+	flshm_sender * sender = malloc(sizeof(flshm_sender));
+	sender->header = malloc(header_size);
+	sender->header_size = header_size;
+	flshm_message_header_encode(message, &lengths, sender->header);
+
+	return sender;
+}
+
+
+void flshm_sender_free(flshm_sender * sender) {
+
+	// Free the header, then the sender itself.
+	free(sender->header);
+	free(sender);
+}
+
+
+bool flshm_sender_write(
+	flshm_sender * sender,
+	flshm_info * info,
+	uint32_t tick,
+	const char * method,
+	const void * data,
+	uint32_t size
+) {
+
+	// Write the message data as a single fragment.
+	flshm_iovec iov;
+	iov.data = data;
+	iov.size = size;
+	return flshm_sender_writev(sender, info, tick, method, &iov, 1);
+}
+
+
+bool flshm_sender_writev(
+	flshm_sender * sender,
+	flshm_info * info,
+	uint32_t tick,
+	const char * method,
+	const flshm_iovec * iov,
+	uint32_t iovcnt
+) {
+
+	// Compute the total size up front, or fail if invalid or too large.
+	uint32_t method_length;
+	uint32_t amfl = flshm_message_body_size(
+		sender->header_size,
+		tick,
+		method,
+		&method_length,
+		iov,
+		iovcnt
+	);
+	if (!amfl) {
+		return false;
+	}
+
+	// Copy the header, then write the method and data, and publish.
+	char * p = flshm_message_retract(info);
+	memcpy(p, sender->header, sender->header_size);
+	flshm_message_body_write(
+		info,
+		p + sender->header_size,
+		tick,
+		amfl,
+		method,
+		method_length,
+		iov,
+		iovcnt
+	);
+
+	return true;
+}
+
+
+bool flshm_message_try_write(
+	flshm_info * info,
+	flshm_message * message,
+	flshm_write_status * status
+) {
+
+	flshm_write_status written;
+	written.tick = 0;
+	written.age = 0;
+
+	// Busy if a message is in the memory, with how long it has been there.
+	uint32_t tick = flshm_message_tick(info);
+	if (tick) {
+		int32_t age = (int32_t)(flshm_tick() - tick);
+		written.result = FLSHM_WRITE_BUSY;
+		written.tick = tick;
+		written.age = age > 0 ? (uint32_t)age : 0;
+	}
+	else {
+		written.result = flshm_message_write(info, message) ?
+			FLSHM_WRITE_WRITTEN :
+			FLSHM_WRITE_INVALID;
+	}
+
+	if (status) {
+		*status = written;
+	}
+	return written.result == FLSHM_WRITE_WRITTEN;
+}
+
+
+void flshm_message_clear(flshm_info * info) {
+
+	// Pointer to shared memory.
+	char * shmdata = (char *)info->data;
+
+	// Write 0 to both the tick and size.
+	flshm_store_release(shmdata + FLSHM_MESSAGE_SIZE_OFFSET, 0);
+	flshm_store_release(shmdata + FLSHM_MESSAGE_TICK_OFFSET, 0);
+}
+
+
+bool flshm_message_send(
+	flshm_info * info,
+	flshm_message * message,
+	uint32_t timeout,
+	flshm_send_status * status
+) {
+
+	flshm_send_status sent;
+	sent.tick = message->tick;
+	sent.latency = 0;
+
+	// Lock to write the message.
+	if (!flshm_lock(info)) {
+		sent.result = FLSHM_SEND_ERROR;
+	}
+	else {
+		if (!message->tick) {
+			message->tick = flshm_tick_next(info);
+		}
+		sent.tick = message->tick;
+		bool written = flshm_message_write(info, message);
+		uint32_t start = flshm_tick();
+		flshm_unlock(info);
+
+		if (!written) {
+			sent.result = FLSHM_SEND_INVALID;
+		}
+		else {
+
+			// Poll the tick without locking, until changed or timed out.
+			char * shmdata = (char *)info->data;
+			flshm_wait_strategy strategy = flshm_wait_strategy_default();
+			uint32_t sleep = strategy.sleep_min;
+			for (uint32_t polls = 0; true; polls++) {
+				uint32_t tick = flshm_load_acquire(
+					shmdata + FLSHM_MESSAGE_TICK_OFFSET
+				);
+
+				// Another tick means another message replaced it.
+				if (tick && tick != sent.tick) {
+					sent.result = FLSHM_SEND_OVERWRITTEN;
+					break;
+				}
+
+				// Keep polling while still there, until the timeout.
+				uint32_t elapsed = flshm_tick() - start;
+				bool expired = elapsed >= timeout;
+				if (tick && !expired) {
+					flshm_backoff(&strategy, polls, &sleep, timeout - elapsed);
+					continue;
+				}
+
+				// Lock to check again, a writer replacing it clears the tick
+				// while writing, so a cleared tick is only final when locked.
+				if (!flshm_lock(info)) {
+					sent.result = FLSHM_SEND_ERROR;
+					break;
+				}
+				tick = flshm_message_tick(info);
+				if (tick == sent.tick && !expired) {
+					flshm_unlock(info);
+					flshm_backoff(&strategy, polls, &sleep, timeout - elapsed);
+					continue;
+				}
+
+				// Clear it if timed out, unless it changed before locked.
+				if (tick == sent.tick) {
+					flshm_message_clear(info);
+					sent.result = FLSHM_SEND_TIMEOUT;
+				}
+				else {
+					sent.result = tick ?
+						FLSHM_SEND_OVERWRITTEN :
+						FLSHM_SEND_DELIVERED;
+				}
+				flshm_unlock(info);
+				break;
+			}
+			sent.latency = flshm_tick() - start;
+		}
+	}
+
+	if (status) {
+		*status = sent;
+	}
+	return sent.result == FLSHM_SEND_DELIVERED;
+}
+
+
+// Private function to signal the watcher fd.
+void flshm_watcher_signal(flshm_watcher * watcher) {
+
+#ifdef _WIN32
+
+	SetEvent(watcher->fd);
+
+#elif __APPLE__
+
+	// Failing when the pipe is full is fine, already readable.
+	char c = 1;
+	if (write(watcher->fd_write, &c, 1) < 0) {
+		return;
+	}
+
+#else
+
+	// Failing on counter overflow is fine, already readable.
+	uint64_t value = 1;
+	if (write(watcher->fd, &value, sizeof(value)) < 0) {
+		return;
+	}
+
+#endif
+
+}
+
+
+// Private function to reset the watcher fd.
+void flshm_watcher_reset(flshm_watcher * watcher) {
+
+#ifdef _WIN32
+
+	ResetEvent(watcher->fd);
+
+#elif __APPLE__
+
+	// Drain the pipe, non-blocking.
+	char buffer[64];
+	while (read(watcher->fd, buffer, sizeof(buffer)) > 0) {}
+
+#else
+
+	// Reading the eventfd resets the counter, fails if already reset.
+	uint64_t value;
+	if (read(watcher->fd, &value, sizeof(value)) < 0) {
+		return;
+	}
+
+#endif
+
+}
+
+
+// Private function run by the watcher thread, polling until stopped.
+#ifdef _WIN32
+DWORD WINAPI flshm_watcher_run(LPVOID arg) {
+#else
+void * flshm_watcher_run(void * arg) {
+#endif
+
+	flshm_watcher * watcher = (flshm_watcher *)arg;
+	char * shmdata = (char *)watcher->info->data;
+
+	while (flshm_load_acquire((char *)&watcher->running)) {
+		uint32_t events = 0;
+
+		// Check for a new message without locking, and who it is for.
+		uint32_t tick = flshm_message_pending(watcher->info);
+		if (tick != watcher->tick) {
+			watcher->tick = tick;
+			if (tick && (
+				!watcher->count ||
+				flshm_message_addressed(
+					shmdata,
+					(const char **)watcher->names,
+					watcher->count
+				)
+			)) {
+				events |= FLSHM_WATCH_MESSAGE;
+			}
+		}
+
+		// Check for connection list changes.
+		if (flshm_connections_snapshot_update(
+			&watcher->connections,
+			shmdata + FLSHM_CONNECTIONS_OFFSET
+		)) {
+			events |= FLSHM_WATCH_CONNECTIONS;
+		}
+
+		// Report any events and signal the fd.
+		if (events) {
+			flshm_atomic_or(&watcher->events, events);
+			flshm_watcher_signal(watcher);
+		}
+
+		flshm_sleep(watcher->interval * 1000);
+	}
+
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+
+flshm_watcher * flshm_watcher_open(
+	flshm_info * info,
+	const char ** names,
+	uint32_t count,
+	uint32_t interval
+) {
+
+	flshm_watcher * watcher = malloc(sizeof(flshm_watcher));
+	watcher->info = info;
+	watcher->interval = interval ? interval : 1;
+	watcher->running = 1;
+	watcher->events = 0;
+
+	// Copy the names, they may not outlive the watcher.
+	watcher->names = NULL;
+	watcher->count = names ? count : 0;
+	if (watcher->count) {
+		watcher->names = malloc(sizeof(char *) * watcher->count);
+		for (uint32_t i = 0; i < watcher->count; i++) {
+			size_t size = strlen(names[i]) + 1;
+			watcher->names[i] = malloc(size);
+			memcpy(watcher->names[i], names[i], size);
+		}
+	}
+
+	// Start from the current state, only report changes.
+	watcher->tick = flshm_message_pending(info);
+	watcher->connections.size = 0;
+	flshm_connections_snapshot_update(
+		&watcher->connections,
+		(char *)info->data + FLSHM_CONNECTIONS_OFFSET
+	);
+
+	// Create the fd, then start the thread.
+	bool success = false;
+
+#ifdef _WIN32
+
+	watcher->fd = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (watcher->fd) {
+		watcher->thread = CreateThread(
+			NULL,
+			0,
+			flshm_watcher_run,
+			watcher,
+			0,
+			NULL
+		);
+		if (watcher->thread) {
+			success = true;
+		}
+		else {
+			CloseHandle(watcher->fd);
+		}
+	}
+
+#elif __APPLE__
+
+	int fds[2];
+	if (!pipe(fds)) {
+		fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+		watcher->fd = fds[0];
+		watcher->fd_write = fds[1];
+		if (!pthread_create(
+			&watcher->thread,
+			NULL,
+			flshm_watcher_run,
+			watcher
+		)) {
+			success = true;
+		}
+		else {
+			close(fds[0]);
+			close(fds[1]);
+		}
+	}
+
+#else
+
+	watcher->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (watcher->fd != -1) {
+		if (!pthread_create(
+			&watcher->thread,
+			NULL,
+			flshm_watcher_run,
+			watcher
+		)) {
+			success = true;
+		}
+		else {
+			close(watcher->fd);
+		}
+	}
+
+#endif
+
+	// Cleanup if failed.
+	if (!success) {
+		watcher->running = 0;
+		flshm_watcher_close(watcher);
+		return NULL;
+	}
+
+	return watcher;
+}
+
+
+void flshm_watcher_close(flshm_watcher * watcher) {
+
+	// Stop the thread if running, and close the fd.
+	if (watcher->running) {
+		flshm_store_release((char *)&watcher->running, 0);
+
+#ifdef _WIN32
+
+		WaitForSingleObject(watcher->thread, INFINITE);
+		CloseHandle(watcher->thread);
+		CloseHandle(watcher->fd);
+
+#elif __APPLE__
+
+		pthread_join(watcher->thread, NULL);
+		close(watcher->fd);
+		close(watcher->fd_write);
+
+#else
+
+		pthread_join(watcher->thread, NULL);
+		close(watcher->fd);
+
+#endif
+
+	}
+
+	// Free the names, then the watcher itself.
+	for (uint32_t i = 0; i < watcher->count; i++) {
+		free(watcher->names[i]);
+	}
+	if (watcher->names) {
+		free(watcher->names);
+	}
+	free(watcher);
+}
+
+
+uint32_t flshm_watcher_events(flshm_watcher * watcher) {
+
+	// Reset the fd first, so events reported after are signaled again.
+	flshm_watcher_reset(watcher);
+	return flshm_atomic_exchange(&watcher->events, 0);
+}
+
+
+// Private function to find the route slot for a prefix.
+// Returns the matching slot, or the empty slot where it would be added.
+flshm_mux_route * flshm_mux_route_find(
+	flshm_mux * mux,
+	const char * prefix,
+	uint32_t size,
+	uint32_t hash
+) {
+
+	// Linear probe from the hash slot, the table is never full.
+	uint32_t mask = mux->capacity - 1;
+	for (uint32_t i = hash & mask; true; i = (i + 1) & mask) {
+		flshm_mux_route * route = &mux->routes[i];
+		if (
+			!route->prefix || (
+				route->hash == hash &&
+				route->size == size &&
+				!memcmp(route->prefix, prefix, size)
+			)
+		) {
+			return route;
+		}
+	}
+}
+
+
+flshm_mux * flshm_mux_create(flshm_connection connection, char separator) {
+
+	// Validate the connection name, getting its size.
+	size_t name_size = connection.name ?
+		flshm_connection_name_length(connection.name) :
+		0;
+	if (!name_size) {
+		return NULL;
+	}
+	name_size++;
+
+	flshm_mux * mux = malloc(sizeof(flshm_mux));
+
+	// Copy the name, it may not outlive the multiplexer.
+	char * name = malloc(name_size);
+	memcpy(name, connection.name, name_size);
+	mux->connection = connection;
+	mux->connection.name = name;
+	mux->separator = separator;
+
+	// Start with an empty table.
+	mux->capacity = 16;
+	mux->count = 0;
+	mux->routes = calloc(mux->capacity, sizeof(flshm_mux_route));
+
+	return mux;
+}
+
+
+void flshm_mux_free(flshm_mux * mux) {
+
+	// Free the route prefixes, the table, the name, then the mux itself.
+	for (uint32_t i = 0; i < mux->capacity; i++) {
+		if (mux->routes[i].prefix) {
+			free(mux->routes[i].prefix);
+		}
+	}
+	free(mux->routes);
+	free((char *)mux->connection.name);
+	free(mux);
+}
+
+
+bool flshm_mux_register(flshm_mux * mux, flshm_info * info) {
+
+	return flshm_connection_add(info, mux->connection);
+}
+
+
+bool flshm_mux_unregister(flshm_mux * mux, flshm_info * info) {
+
+	return flshm_connection_remove(info, mux->connection);
+}
+
+
+bool flshm_mux_route_add(
+	flshm_mux * mux,
+	const char * prefix,
+	flshm_mux_handler handler,
+	void * context
+) {
+
+	// Fail if already routed.
+	uint32_t size = strlen(prefix);
+	uint32_t hash = flshm_hash_string(prefix, size);
+	if (flshm_mux_route_find(mux, prefix, size, hash)->prefix) {
+		return false;
+	}
+
+	// Grow the table if it would be over half full, and reinsert everything.
+	if ((mux->count + 1) * 2 > mux->capacity) {
+		flshm_mux_route * routes = mux->routes;
+		uint32_t capacity = mux->capacity;
+		mux->capacity = capacity * 2;
+		mux->routes = calloc(mux->capacity, sizeof(flshm_mux_route));
+		for (uint32_t i = 0; i < capacity; i++) {
+			flshm_mux_route * route = &routes[i];
+			if (route->prefix) {
+				*flshm_mux_route_find(
+					mux,
+					route->prefix,
+					route->size,
+					route->hash
+				) = *route;
+			}
+		}
+		free(routes);
+	}
+
+	// Copy the prefix into the empty slot.
+	flshm_mux_route * route = flshm_mux_route_find(mux, prefix, size, hash);
+	route->prefix = malloc(size + 1);
+	memcpy(route->prefix, prefix, size + 1);
+	route->size = size;
+	route->hash = hash;
+	route->handler = handler;
+	route->context = context;
+	mux->count++;
+
+	return true;
+}
+
+
+bool flshm_mux_route_remove(flshm_mux * mux, const char * prefix) {
+
+	// Fail if not routed.
+	uint32_t size = strlen(prefix);
+	uint32_t hash = flshm_hash_string(prefix, size);
+	flshm_mux_route * route = flshm_mux_route_find(mux, prefix, size, hash);
+	if (!route->prefix) {
+		return false;
+	}
+	free(route->prefix);
+	route->prefix = NULL;
+	mux->count--;
+
+	// Shift back the following routes that probed past the removed slot.
+	uint32_t mask = mux->capacity - 1;
+	uint32_t empty = route - mux->routes;
+	for (
+		uint32_t i = (empty + 1) & mask;
+		mux->routes[i].prefix;
+		i = (i + 1) & mask
+	) {
+		uint32_t home = mux->routes[i].hash & mask;
+		if (((i - home) & mask) >= ((i - empty) & mask)) {
+			mux->routes[empty] = mux->routes[i];
+			mux->routes[i].prefix = NULL;
+			empty = i;
+		}
+	}
+
+	return true;
+}
+
+
+bool flshm_mux_dispatch(flshm_mux * mux, flshm_message * message) {
+
+	// Check that this message is intended for this.
+	if (!message->name || strcmp(message->name, mux->connection.name)) {
+		return false;
+	}
+
+	// Split the method into the prefix and the rest.
+	const char * method = message->method;
+	uint32_t size = strlen(method);
+	uint32_t prefix_size = flshm_scan(
+		method,
+		size,
+		mux->separator,
+		mux->separator
+	);
+	const char * rest = method + prefix_size;
+	if (prefix_size < size) {
+		rest++;
+	}
+
+	// Lookup the route and call the handler.
+	flshm_mux_route * route = flshm_mux_route_find(
+		mux,
+		method,
+		prefix_size,
+		flshm_hash_string(method, prefix_size)
+	);
+	if (!route->prefix) {
+		return false;
+	}
+	route->handler(message, rest, route->context);
+	return true;
+}
+
+
+// Private function to mix 2 hashes into a well distributed score.
+uint32_t flshm_hash_mix(uint32_t a, uint32_t b) {
+
+	// MurmurHash3 finalizer.
+	uint32_t h = a ^ (b * 0x9E3779B1);
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
+}
+
+
+flshm_shard * flshm_shard_create(const char * prefix) {
+
+	flshm_shard * shard = malloc(sizeof(flshm_shard));
+
+	// Copy the prefix.
+	shard->prefix_size = strlen(prefix);
+	shard->prefix = malloc(shard->prefix_size + 1);
+	memcpy(shard->prefix, prefix, shard->prefix_size + 1);
 
-	// Add list terminating null.
-	*(addr) = '\0';
+	// No members until refreshed.
+	shard->count = 0;
+	shard->snapshot.size = 0;
 
-	return found;
+	return shard;
 }
 
 
-uint32_t flshm_message_tick(flshm_info * info) {
+void flshm_shard_free(flshm_shard * shard) {
 
-	// Read the tick from the memory.
-	return *((uint32_t *)((char *)info->data + FLSHM_MESSAGE_TICK_OFFSET));
+	for (uint32_t i = 0; i < shard->count; i++) {
+		free((char *)shard->members[i].connection.name);
+	}
+	free(shard->prefix);
+	free(shard);
 }
 
 
-void flshm_message_free(flshm_message * message) {
+bool flshm_shard_refresh(flshm_shard * shard, flshm_info * info) {
 
-	// Free any and all memory associated with the message structure.
-	if (message->name) {
-		free(message->name);
+	// Nothing joined or left if the connection list is unchanged.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+	if (!flshm_connections_snapshot_update(&shard->snapshot, memory)) {
+		return false;
 	}
-	if (message->host) {
-		free(message->host);
+
+	// Find the connections with the prefix.
+	flshm_connection_index * index = flshm_connection_index_get(info);
+	flshm_connection_entry * found[FLSHM_CONNECTIONS_MAX_COUNT];
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < index->connected.count; i++) {
+		flshm_connection_entry * entry = &index->entries[i];
+		if (
+			entry->length >= shard->prefix_size &&
+			!memcmp(entry->connection.name, shard->prefix, shard->prefix_size)
+		) {
+			found[count++] = entry;
+		}
 	}
-	if (message->filepath) {
-		free(message->filepath);
+
+	// Unchanged if every one found is already a member.
+	bool changed = count != shard->count;
+	for (uint32_t i = 0; i < count && !changed; i++) {
+		bool member = false;
+		for (uint32_t j = 0; j < shard->count && !member; j++) {
+			member = (
+				shard->members[j].size == found[i]->length &&
+				!memcmp(
+					shard->members[j].connection.name,
+					found[i]->connection.name,
+					found[i]->length
+				)
+			);
+		}
+		changed = !member;
 	}
-	if (message->method) {
-		free(message->method);
+	if (!changed) {
+		return false;
 	}
-	if (message->data) {
-		free(message->data);
+
+	// Replace the members, copying the names out of the shared memory.
+	for (uint32_t i = 0; i < shard->count; i++) {
+		free((char *)shard->members[i].connection.name);
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		flshm_shard_member * member = &shard->members[i];
+		char * name = malloc(found[i]->length + 1);
+		memcpy(name, found[i]->connection.name, found[i]->length);
+		name[found[i]->length] = '\0';
+		member->connection = found[i]->connection;
+		member->connection.name = name;
+		member->size = found[i]->length;
+		member->hash = flshm_hash_string(name, member->size);
 	}
+	shard->count = count;
 
-	// Then free the message structure itself.
-	free(message);
+	return true;
 }
 
 
-flshm_message * flshm_message_read(flshm_info * info) {
+const flshm_shard_member * flshm_shard_pick(
+	flshm_shard * shard,
+	const char * key,
+	uint32_t size
+) {
+
+	// Pick the member with the highest score for the key.
+	uint32_t hash = flshm_hash_string(key, size);
+	const flshm_shard_member * picked = NULL;
+	uint32_t score_max = 0;
+	for (uint32_t i = 0; i < shard->count; i++) {
+		uint32_t score = flshm_hash_mix(shard->members[i].hash, hash);
+		if (!picked || score > score_max) {
+			picked = &shard->members[i];
+			score_max = score;
+		}
+	}
+	return picked;
+}
 
-	// All the properties to be set.
-	uint32_t tick;
-	uint32_t amfl;
-	char * name;
-	char * host;
-	flshm_version version = FLSHM_VERSION_1;
-	bool sandboxed = false;
-	bool https = false;
-	flshm_security sandbox = 0;
-	uint32_t swfv = 0;
-	char * filepath = NULL;
-	flshm_amf amfv = FLSHM_AMF0;
-	char * method = NULL;
-	uint32_t size = 0;
-	void * data = NULL;
 
-	double d2i;
+flshm_owners * flshm_owners_open(bool is_per_user) {
 
-	// Default to returning null.
-	flshm_message * message = NULL;
+	// Derive the sidecar keys from the main keys.
+	flshm_keys keys = flshm_get_keys(is_per_user);
 
-	// Pointer to shared memory.
-	char * shmdata = (char *)info->data;
+	flshm_owners * owners = NULL;
+	size_t size = sizeof(flshm_owner) * FLSHM_OWNERS_MAX_COUNT;
 
-	// Read the tick count and check if set (only valid if non-zero).
-	tick = *((uint32_t *)(shmdata + FLSHM_MESSAGE_TICK_OFFSET));
-	if (!tick) {
+#ifdef _WIN32
+
+	// Open or create the shared memory, created zeroed.
+	char name[32];
+	snprintf(name, sizeof(name), "%sOwners", keys.shm);
+	HANDLE shm = CreateFileMapping(
+		INVALID_HANDLE_VALUE,
+		NULL,
+		PAGE_READWRITE,
+		0,
+		(DWORD)size,
+		name
+	);
+	if (shm == NULL) {
 		return NULL;
 	}
 
-	// Read the message size if present and sanity check it.
-	amfl = *((uint32_t *)(shmdata + FLSHM_MESSAGE_SIZE_OFFSET));
-	if (!amfl || amfl > FLSHM_MESSAGE_MAX_SIZE) {
+	// Attach to the shared memory.
+	LPVOID shmaddr = MapViewOfFile(shm, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (shmaddr == NULL) {
+		CloseHandle(shm);
 		return NULL;
 	}
 
-	// Keep track of position and bounds.
-	uint32_t i = FLSHM_MESSAGE_BODY_OFFSET;
-	uint32_t max = FLSHM_MESSAGE_BODY_OFFSET + amfl;
-	uint32_t read;
+	owners = malloc(sizeof(flshm_owners));
+	owners->records = (flshm_owner *)shmaddr;
+	owners->shm = shm;
 
-	// Start a block that can be broken from, assume failure on break.
-	do {
-		// Read the connection name, or fail.
-		if (!(read = flshm_amf0_read_string(
-			&name,
-			shmdata + i,
-			max - i
-		))) {
-			break;
-		}
-		i += read;
+#else
 
-		// Read the host name, or fail.
-		if (!(read = flshm_amf0_read_string(
-			&host,
-			shmdata + i,
-			max - i
-		))) {
-			break;
-		}
-		i += read;
+	// Open or create the shared memory, created zeroed.
+	key_t key = keys.shm ^ (key_t)0x4F574E52; // OWNR
+	int shmid = shmget(key, size, IPC_CREAT | 0600);
+	if (shmid == -1) {
+		return NULL;
+	}
 
-		// Read the optional data, if present, based on first boolean.
+	// Attach to the shared memory.
+	void * shmaddr = shmat(shmid, NULL, 0);
+	if (shmaddr == (void *)-1) {
+		return NULL;
+	}
 
-		// Read version 2 data if present.
-		if ((read = flshm_amf0_read_boolean(
-			&sandboxed,
-			shmdata + i,
-			max - i
-		))) {
-			// Read sandboxed successfully.
-			i += read;
+	owners = malloc(sizeof(flshm_owners));
+	owners->records = (flshm_owner *)shmaddr;
+	owners->shmid = shmid;
 
-			// We have version 2 at least, read data.
-			version = FLSHM_VERSION_2;
+#endif
 
-			// Read HTTPS or fail.
-			if (!(read = flshm_amf0_read_boolean(
-				&https,
-				shmdata + i,
-				max - i
-			))) {
-				break;
-			}
-			i += read;
+	return owners;
+}
 
-			// Read version 3 data if present, based on first double.
-			if ((read = flshm_amf0_read_double(
-				&d2i,
-				shmdata + i,
-				max - i
-			))) {
-				// Read sandbox successfully.
-				sandbox = (int32_t)d2i;
-				i += read;
 
-				// We have version 3 at least, read data.
-				version = FLSHM_VERSION_3;
+void flshm_owners_close(flshm_owners * owners) {
 
-				// Read version or fail.
-				if (!(read = flshm_amf0_read_double(
-					&d2i,
-					shmdata + i,
-					max - i
-				))) {
-					break;
-				}
-				swfv = (uint32_t)d2i;
-				i += read;
+#ifdef _WIN32
 
-				// If sandbox local-with-file, includes sender filepath.
-				if (sandbox == FLSHM_SECURITY_LOCAL_WITH_FILE) {
-					if (!(read = flshm_amf0_read_string(
-						&filepath,
-						shmdata + i,
-						max - i
-					))) {
-						break;
-					}
-					i += read;
-				}
+	// Detach and close, does not persist once everything closes.
+	UnmapViewOfFile(owners->records);
+	CloseHandle(owners->shm);
 
-				// Read AMF version if present, else ignore.
-				if ((read = flshm_amf0_read_double(
-					&d2i,
-					shmdata + i,
-					max - i
-				))) {
-					amfv = (uint32_t)d2i;
-					i += read;
+#else
 
-					// Version must be 4.
-					version = FLSHM_VERSION_4;
-				}
-			}
-		}
+	// Detach, the memory persists for the next process.
+	shmdt(owners->records);
 
-		// Read the method name or fail.
-		if (!(read = flshm_amf0_read_string(
-			&method,
-			shmdata + i,
-			max - i
-		))) {
-			break;
-		}
-		i += read;
+#endif
 
-		// Calculate the size of the message, and copy to memory.
-		size = max - i;
-		if (size) {
-			data = malloc(size);
-			memcpy(data, shmdata + i, size);
-		}
+	owners->records = NULL;
+	free(owners);
+}
 
-		// Everything needed, allocate and return struct.
-		message = malloc(sizeof(flshm_message));
 
-		message->tick = tick;
-		message->amfl = amfl;
-		message->name = name;
-		message->host = host;
-		message->version = version;
-		message->sandboxed = sandboxed;
-		message->https = https;
-		message->sandbox = sandbox;
-		message->swfv = swfv;
-		message->filepath = filepath;
-		message->amfv = amfv;
-		message->method = method;
-		message->size = size;
-		message->data = data;
-	} while (false);
+// Private function to get the id of this process.
+uint32_t flshm_owners_pid(void) {
 
-	// If message not initialized, cleanup any memory allocated.
-	if (!message) {
-		if (filepath) {
-			free(filepath);
-		}
-		if (host) {
-			free(host);
-		}
-		if (name) {
-			free(name);
-		}
+#ifdef _WIN32
+
+	return (uint32_t)GetCurrentProcessId();
+
+#else
+
+	return (uint32_t)getpid();
+
+#endif
+
+}
+
+
+// Private function to check if a process is still running.
+bool flshm_owners_alive(uint32_t pid) {
+
+#ifdef _WIN32
+
+	// Not running if it cannot be opened for not existing, or has exited.
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+	if (process == NULL) {
+		return GetLastError() != ERROR_INVALID_PARAMETER;
 	}
+	bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+
+#else
+
+	// Still running unless there is no such process to signal.
+	return !kill((pid_t)pid, 0) || errno != ESRCH;
+
+#endif
 
-	return message;
 }
 
 
-bool flshm_message_write(flshm_info * info, flshm_message * message) {
+// Private function to find the record for a name, or NULL.
+flshm_owner * flshm_owners_find(
+	flshm_owners * owners,
+	const char * name,
+	uint32_t size
+) {
 
-	// Validate tick is non-0.
-	if (!message->tick) {
-		return false;
+	for (uint32_t i = 0; i < FLSHM_OWNERS_MAX_COUNT; i++) {
+		flshm_owner * record = &owners->records[i];
+		if (record->size == size && !memcmp(record->name, name, size)) {
+			return record;
+		}
 	}
-	// Validate connection is set and valid.
-	if (!message->name || !flshm_connection_name_valid(message->name)) {
+	return NULL;
+}
+
+
+bool flshm_owners_claim(flshm_owners * owners, const char * name) {
+
+	// Fail if the name does not fit in a record.
+	uint32_t size = strlen(name);
+	if (!size || size >= FLSHM_OWNER_NAME_MAX_SIZE) {
 		return false;
 	}
-	// Validate host is set and valid.
-	if (!message->host || strlen(message->host) > 0xFFFF) {
+
+	// Reuse the record for the name if any, else the first unused one.
+	flshm_owner * record = flshm_owners_find(owners, name, size);
+	for (uint32_t i = 0; !record && i < FLSHM_OWNERS_MAX_COUNT; i++) {
+		if (!owners->records[i].size) {
+			record = &owners->records[i];
+		}
+	}
+	if (!record) {
 		return false;
 	}
-	// If local-with-file sandbox, ensure filepath is set and valid.
-	if (
-		message->version >= FLSHM_VERSION_3 &&
-		message->sandbox == FLSHM_SECURITY_LOCAL_WITH_FILE &&
-		(!message->filepath || strlen(message->filepath) > 0xFFFF)
-	) {
+
+	memcpy(record->name, name, size + 1);
+	record->size = size;
+	record->pid = flshm_owners_pid();
+	record->tick = flshm_tick();
+	return true;
+}
+
+
+bool flshm_owners_heartbeat(flshm_owners * owners, const char * name) {
+
+	flshm_owner * record = flshm_owners_find(owners, name, strlen(name));
+	if (!record || record->pid != flshm_owners_pid()) {
 		return false;
 	}
-	// Validate method is set and valid.
-	if (!message->method || strlen(message->method) > 0xFFFF) {
+
+	record->tick = flshm_tick();
+	return true;
+}
+
+
+bool flshm_owners_release(flshm_owners * owners, const char * name) {
+
+	flshm_owner * record = flshm_owners_find(owners, name, strlen(name));
+	if (!record || record->pid != flshm_owners_pid()) {
 		return false;
 	}
 
-	// Allocate memory to encode message into.
-	char * buffer = malloc(FLSHM_MESSAGE_MAX_SIZE);
+	memset(record, 0, sizeof(flshm_owner));
+	return true;
+}
 
-	// Start a block that can be broken from, assume failure on break.
-	bool success = false;
-	do {
-		// Keep track of offset and bounds.
-		uint32_t i = 0;
-		uint32_t max = FLSHM_MESSAGE_MAX_SIZE;
-		uint32_t wrote;
-
-		// Write the connection name or fail.
-		if (!(wrote = flshm_amf0_write_string(
-			message->name,
-			buffer + i,
-			max - i
-		))) {
+
+uint32_t flshm_owners_reap(
+	flshm_owners * owners,
+	flshm_info * info,
+	uint32_t timeout
+) {
+
+	// Forget the records of dead or silent owners first.
+	uint32_t tick = flshm_tick();
+	bool reaped[FLSHM_OWNERS_MAX_COUNT];
+	bool any = false;
+	for (uint32_t i = 0; i < FLSHM_OWNERS_MAX_COUNT; i++) {
+		flshm_owner * record = &owners->records[i];
+		reaped[i] = record->size && (
+			(timeout && tick - record->tick > timeout) ||
+			!flshm_owners_alive(record->pid)
+		);
+		any = any || reaped[i];
+	}
+	if (!any) {
+		return 0;
+	}
+
+	// Map out the memory.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+
+	// Move everything kept back over the removed entries before it.
+	// Anything between entries, like invalid names, is kept with them.
+	flshm_connection_entry entry;
+	uint32_t i = 0;
+	uint32_t done = 0;
+	uint32_t kept = 0;
+	uint32_t removed = 0;
+	for (uint32_t count = 0; count < FLSHM_CONNECTIONS_MAX_COUNT; count++) {
+		if (!flshm_connection_parse_next(memory, &i, &entry)) {
 			break;
 		}
-		i += wrote;
+		flshm_owner * record = flshm_owners_find(
+			owners,
+			entry.connection.name,
+			entry.length
+		);
+		uint32_t end = i;
+		if (record && reaped[record - owners->records]) {
+			end = entry.offset;
+			removed++;
+		}
 
-		// Write the connection host or fail.
-		if (!(wrote = flshm_amf0_write_string(
-			message->host,
-			buffer + i,
-			max - i
-		))) {
-			break;
+		// Nothing moves until after the first removed entry.
+		if (kept != done) {
+			memmove(memory + kept, memory + done, end - done);
 		}
-		i += wrote;
+		kept += end - done;
+		done = i;
+	}
 
-		// Add version 2 data if specified.
-		if (message->version >= FLSHM_VERSION_2) {
+	// Move the rest of the list back too, the terminating null included.
+	if (kept != done) {
+		uint32_t tail = flshm_connections_used(
+			memory + done,
+			FLSHM_CONNECTIONS_SIZE - done
+		);
+		memmove(memory + kept, memory + done, tail);
 
-			// Write sandboxed or fail.
-			if (!(wrote = flshm_amf0_write_boolean(
-				message->sandboxed,
-				buffer + i,
-				max - i
-			))) {
-				break;
-			}
-			i += wrote;
+		// Clear the memory left behind after the end of the list.
+		memset(memory + kept + tail, 0, done - kept);
+	}
 
-			// Write HTTPS or fail.
-			if (!(wrote = flshm_amf0_write_boolean(
-				message->https,
-				buffer + i,
-				max - i
-			))) {
-				break;
-			}
-			i += wrote;
+	// Free the records.
+	for (uint32_t r = 0; r < FLSHM_OWNERS_MAX_COUNT; r++) {
+		if (reaped[r]) {
+			memset(&owners->records[r], 0, sizeof(flshm_owner));
+		}
+	}
 
-			// Add version 3 data if specified.
-			if (message->version >= FLSHM_VERSION_3) {
+	return removed;
+}
 
-				// Write sandbox or fail.
-				if (!(wrote = flshm_amf0_write_double(
-					(double)message->sandbox,
-					buffer + i,
-					max - i
-				))) {
-					break;
-				}
-				i += wrote;
 
-				// Write version or fail.
-				if (!(wrote = flshm_amf0_write_double(
-					(double)message->swfv,
-					buffer + i,
-					max - i
-				))) {
-					break;
-				}
-				i += wrote;
-
-				// Write filepath if local-with-file or fail.
-				if (
-					message->sandboxed &&
-					message->sandbox == FLSHM_SECURITY_LOCAL_WITH_FILE
-				) {
-					if (!(wrote = flshm_amf0_write_string(
-						message->filepath,
-						buffer + i,
-						max - i
-					))) {
-						break;
-					}
-					i += wrote;
-				}
+flshm_feed * flshm_feed_create(void) {
 
-				// Add version 4 data if specified.
-				if (message->version >= FLSHM_VERSION_4) {
-					// Write the AMF version or fail.
-					if (!(wrote = flshm_amf0_write_double(
-						(double)message->amfv,
-						buffer + i,
-						max - i
-					))) {
-						break;
-					}
-					i += wrote;
-				}
-			}
-		}
+	flshm_feed * feed = malloc(sizeof(flshm_feed));
 
-		// Write method or fail.
-		if (!(wrote = flshm_amf0_write_string(
-			message->method,
-			buffer + i,
-			max - i
-		))) {
-			break;
-		}
-		i += wrote;
+	// Start from an empty list, without subscribers.
+	feed->connected.count = 0;
+	feed->subscribers = NULL;
+	feed->count = 0;
+	feed->capacity = 0;
+	feed->snapshot.size = 0;
 
-		// Check that message data will fit.
-		if (message->size > max - i) {
-			break;
-		}
+	return feed;
+}
+
+
+void flshm_feed_free(flshm_feed * feed) {
+
+	for (uint32_t i = 0; i < feed->connected.count; i++) {
+		free((char *)feed->connected.connections[i].name);
+	}
+	free(feed->subscribers);
+	free(feed);
+}
 
-		// Write message data to the buffer.
-		memcpy(buffer + i, message->data, message->size);
-		i += message->size;
 
-		// Set the total AMF size on the struct.
-		message->amfl = i;
+void flshm_feed_subscribe(
+	flshm_feed * feed,
+	flshm_feed_callback callback,
+	void * context
+) {
+
+	// Grow the subscribers if full.
+	if (feed->count == feed->capacity) {
+		feed->capacity = feed->capacity ? feed->capacity * 2 : 8;
+		feed->subscribers = realloc(
+			feed->subscribers,
+			feed->capacity * sizeof(flshm_feed_subscriber)
+		);
+	}
+
+	flshm_feed_subscriber * subscriber = &feed->subscribers[feed->count++];
+	subscriber->callback = callback;
+	subscriber->context = context;
+}
 
-		// Pointer to shared memory.
-		char * shmdata = (char *)info->data;
 
-		// Copy buffer to the shared memory.
-		memcpy(shmdata + FLSHM_MESSAGE_BODY_OFFSET, buffer, i);
+bool flshm_feed_unsubscribe(
+	flshm_feed * feed,
+	flshm_feed_callback callback,
+	void * context
+) {
 
-		// Set the size of the message.
-		*((uint32_t *)(shmdata + FLSHM_MESSAGE_SIZE_OFFSET)) = i;
+	// Remove the first match, keeping the others in order.
+	for (uint32_t i = 0; i < feed->count; i++) {
+		flshm_feed_subscriber * subscriber = &feed->subscribers[i];
+		if (
+			subscriber->callback == callback &&
+			subscriber->context == context
+		) {
+			memmove(
+				subscriber,
+				subscriber + 1,
+				(feed->count - i - 1) * sizeof(flshm_feed_subscriber)
+			);
+			feed->count--;
+			return true;
+		}
+	}
+	return false;
+}
 
-		// Set the message tick.
-		*((uint32_t *)(shmdata + FLSHM_MESSAGE_TICK_OFFSET)) =
-			message->tick;
 
-		// If finished the block, then successful.
-		success = true;
-	} while (false);
+// Private function to report a change to every subscriber.
+void flshm_feed_emit(
+	flshm_feed * feed,
+	flshm_feed_change change,
+	const flshm_connection * connection
+) {
 
-	// Free the memory and return successful or not.
-	free(buffer);
-	return success;
+	for (uint32_t i = 0; i < feed->count; i++) {
+		flshm_feed_subscriber * subscriber = &feed->subscribers[i];
+		subscriber->callback(change, connection, subscriber->context);
+	}
 }
 
-void flshm_message_clear(flshm_info * info) {
 
-	// Pointer to shared memory.
-	char * shmdata = (char *)info->data;
+uint32_t flshm_feed_update(flshm_feed * feed, flshm_info * info) {
 
-	// Write 0 to both the tick and size.
-	*((uint32_t *)(shmdata + FLSHM_MESSAGE_SIZE_OFFSET)) = 0;
-	*((uint32_t *)(shmdata + FLSHM_MESSAGE_TICK_OFFSET)) = 0;
+	// Nothing to report if the connection list is unchanged.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+	if (!flshm_connections_snapshot_update(&feed->snapshot, memory)) {
+		return 0;
+	}
+	flshm_connection_index * index = flshm_connection_index_get(info);
+	uint32_t count = index->connected.count;
+
+	// Match the listed connections to the last ones seen.
+	bool listed[FLSHM_CONNECTIONS_MAX_COUNT];
+	bool seen[FLSHM_CONNECTIONS_MAX_COUNT];
+	for (uint32_t i = 0; i < count; i++) {
+		listed[i] = false;
+	}
+	for (uint32_t i = 0; i < feed->connected.count; i++) {
+		flshm_connection * last = &feed->connected.connections[i];
+		seen[i] = false;
+		for (uint32_t j = 0; j < count && !seen[i]; j++) {
+			flshm_connection_entry * entry = &index->entries[j];
+			if (
+				!listed[j] &&
+				entry->connection.version == last->version &&
+				entry->connection.sandbox == last->sandbox &&
+				entry->length == feed->sizes[i] &&
+				!memcmp(entry->connection.name, last->name, feed->sizes[i])
+			) {
+				listed[j] = seen[i] = true;
+			}
+		}
+	}
+
+	// Report and forget the removed ones, keeping the rest in order.
+	uint32_t changes = 0;
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < feed->connected.count; i++) {
+		flshm_connection * last = &feed->connected.connections[i];
+		if (!seen[i]) {
+			flshm_feed_emit(feed, FLSHM_FEED_REMOVED, last);
+			free((char *)last->name);
+			changes++;
+			continue;
+		}
+		feed->connected.connections[kept] = *last;
+		feed->sizes[kept] = feed->sizes[i];
+		kept++;
+	}
+	feed->connected.count = kept;
+
+	// Remember and report the added ones, copying the names.
+	for (uint32_t j = 0; j < count; j++) {
+		if (listed[j]) {
+			continue;
+		}
+		flshm_connection_entry * entry = &index->entries[j];
+		char * name = malloc(entry->length + 1);
+		memcpy(name, entry->connection.name, entry->length);
+		name[entry->length] = '\0';
+		flshm_connection * added =
+			&feed->connected.connections[feed->connected.count];
+		*added = entry->connection;
+		added->name = name;
+		feed->sizes[feed->connected.count] = entry->length;
+		feed->connected.count++;
+		flshm_feed_emit(feed, FLSHM_FEED_ADDED, added);
+		changes++;
+	}
+
+	return changes;
 }
@@ -10,9 +10,11 @@
 	#include <sys/types.h>
 	#include <sys/shm.h>
 	#include <semaphore.h>
+	#include <pthread.h>
 #else
 	#include <sys/types.h>
 	#include <sys/shm.h>
+	#include <pthread.h>
 #endif
 
 
@@ -64,6 +66,18 @@
 #define FLSHM_CONNECTIONS_MAX_COUNT 8
 
 
+/**
+ * The maximum number of connection owners recorded in the sidecar memory.
+ */
+#define FLSHM_OWNERS_MAX_COUNT 32
+
+
+/**
+ * The maximum size of a connection name recorded as owned, with the null.
+ */
+#define FLSHM_OWNER_NAME_MAX_SIZE 256
+
+
 
 
 /**
@@ -108,6 +122,70 @@ typedef enum flshm_amf {
 
 
 
+/**
+ * The result of trying to lock the semaphore.
+ */
+typedef enum flshm_lock_status {
+	FLSHM_LOCK_ACQUIRED = 0, // Locked.
+	FLSHM_LOCK_BUSY     = 1, // Locked by another, not waiting.
+	FLSHM_LOCK_TIMEOUT  = 2, // Locked by another, until the timeout.
+	FLSHM_LOCK_ERROR    = 3  // Failed to lock.
+} flshm_lock_status;
+
+
+/**
+ * The events reported by a watcher, as bit flags.
+ */
+typedef enum flshm_watch_event {
+	FLSHM_WATCH_MESSAGE     = 1, // A message for a watched name arrived.
+	FLSHM_WATCH_CONNECTIONS = 2  // The connection list changed.
+} flshm_watch_event;
+
+
+/**
+ * The result of writing a message only if no message is pending.
+ */
+typedef enum flshm_write_result {
+	FLSHM_WRITE_WRITTEN = 0, // Written.
+	FLSHM_WRITE_BUSY    = 1, // Another message is pending, not written.
+	FLSHM_WRITE_INVALID = 2  // The message is invalid, not written.
+} flshm_write_result;
+
+
+/**
+ * The result of sending a message and waiting for it to be received.
+ */
+typedef enum flshm_send_result {
+	FLSHM_SEND_DELIVERED   = 0, // Cleared by the receiver.
+	FLSHM_SEND_TIMEOUT     = 1, // Not received before the timeout, cleared.
+	FLSHM_SEND_OVERWRITTEN = 2, // Replaced by another message.
+	FLSHM_SEND_INVALID     = 3, // The message is invalid, not sent.
+	FLSHM_SEND_ERROR       = 4  // Failed to lock.
+} flshm_send_result;
+
+
+/**
+ * The changes reported by a connection feed.
+ */
+typedef enum flshm_feed_change {
+	FLSHM_FEED_ADDED   = 0, // The connection was registered.
+	FLSHM_FEED_REMOVED = 1  // The connection was removed.
+} flshm_feed_change;
+
+
+/**
+ * The result of adding a connection.
+ */
+typedef enum flshm_connection_status {
+	FLSHM_CONNECTION_ADDED     = 0, // Added.
+	FLSHM_CONNECTION_INVALID   = 1, // The name is not valid.
+	FLSHM_CONNECTION_DUPLICATE = 2, // The name is already registered.
+	FLSHM_CONNECTION_FULL      = 3, // The maximum connections are registered.
+	FLSHM_CONNECTION_NO_SPACE  = 4  // The list memory is full.
+} flshm_connection_status;
+
+
+
 
 /**
  * The keys used to open the semaphore and shared memory.
@@ -135,15 +213,77 @@ typedef struct flshm_keys {
 } flshm_keys;
 
 
+/**
+ * An owner record, the process that registered a connection name.
+ * Names are recorded in full, all zero if the record is unused.
+ */
+typedef struct flshm_owner {
+	/**
+	 * The length of the connection name.
+	 */
+	uint32_t size;
+	/**
+	 * The process id of the owner.
+	 */
+	uint32_t pid;
+	/**
+	 * The tick of the last heartbeat.
+	 */
+	uint32_t tick;
+	/**
+	 * The connection name, null terminated.
+	 */
+	char name[FLSHM_OWNER_NAME_MAX_SIZE];
+} flshm_owner;
+
+
+/**
+ * The info for the sidecar shared memory recording connection owners.
+ * It is not used by Flash Player, only native processes using the library.
+ * Everything but the records member is platform specific.
+ */
+typedef struct flshm_owners {
+	/**
+	 * The owner records, in the shared memory.
+	 */
+	flshm_owner * records;
+
+#ifdef _WIN32
+
+	HANDLE shm;
+
+#else
+
+	int shmid;
+
+#endif
+
+} flshm_owners;
+
+
+/**
+ * The cached connection list, defined below.
+ */
+typedef struct flshm_connection_index flshm_connection_index;
+
+
 /**
  * The info for the semaphore and shared memory.
- * Everything but the data member is platform specific.
+ * Everything but the data, index, and tick members is platform specific.
  */
 typedef struct flshm_info {
 	/**
 	 * The address of the shared memory.
 	 */
 	void * data;
+	/**
+	 * The cached connection list, NULL until first listed.
+	 */
+	flshm_connection_index * index;
+	/**
+	 * The last tick from flshm_tick_next, accessed atomically.
+	 */
+	uint32_t tick;
 
 #ifdef _WIN32
 
@@ -202,6 +342,68 @@ typedef struct flshm_connected {
 } flshm_connected;
 
 
+/**
+ * A connection in the list, with where it is found in the memory.
+ */
+typedef struct flshm_connection_entry {
+	/**
+	 * The connection, the name points directly to the shared memory.
+	 */
+	flshm_connection connection;
+	/**
+	 * The offset of the entry from the start of the connection list.
+	 */
+	uint32_t offset;
+	/**
+	 * The length of the connection name.
+	 */
+	uint32_t length;
+	/**
+	 * The size of the entry, including the null bytes and meta data.
+	 */
+	uint32_t size;
+} flshm_connection_entry;
+
+
+/**
+ * A copy of the used part of the connection list, to detect changes.
+ */
+typedef struct flshm_connections_snapshot {
+	/**
+	 * The copied memory, including the list terminating null.
+	 */
+	char data[FLSHM_CONNECTIONS_SIZE];
+	/**
+	 * The size of the copied memory, 0 if not yet copied.
+	 */
+	uint32_t size;
+} flshm_connections_snapshot;
+
+
+/**
+ * The connection list cached for an info, reparsed only when changed.
+ */
+struct flshm_connection_index {
+	/**
+	 * The parsed connection list.
+	 */
+	flshm_connected connected;
+	/**
+	 * The parsed connection list entries.
+	 */
+	flshm_connection_entry entries[FLSHM_CONNECTIONS_MAX_COUNT];
+	/**
+	 * The offset of the list terminating null, where new entries are added.
+	 * FLSHM_CONNECTIONS_SIZE if not found.
+	 */
+	uint32_t end;
+	/**
+	 * The memory the list was parsed from.
+	 */
+	flshm_connections_snapshot snapshot;
+};
+
+
 /**
  * Message structure containing all the data for an active message.
  */
@@ -280,104 +482,1006 @@ typedef struct flshm_message {
 } flshm_message;
 
 
-
-
-/**
- * Generate a message tick.
- * Based on current time, but can return 0 in theory.
- */
-uint32_t flshm_tick();
-
-
-/**
- * Get the keys to open a connection with.
- * is_per_user has same functionality of the ASVM isPerUser.
- * Should be set to match the ASVM targeted.
- */
-flshm_keys flshm_get_keys(bool is_per_user);
-
-
 /**
- * Open the semaphores and shared memory.
- * is_per_user has same functionality of the ASVM isPerUser.
- * Should be set to match the ASVM targeted.
+ * A string pointing directly into memory, without a null terminator.
  */
-flshm_info * flshm_open(bool is_per_user);
+typedef struct flshm_string {
+	/**
+	 * The string characters, NULL if not present.
+	 */
+	const char * data;
+	/**
+	 * The length of the string.
+	 */
+	uint32_t size;
+} flshm_string;
 
 
 /**
- * Close the semaphores and shared memory, freeing memory.
+ * Message view structure, like flshm_message but without copying anything.
+ * Strings and data point directly to the shared memory.
+ * These are only valid while the lock is held and the message is unchanged.
  */
-void flshm_close(flshm_info * info);
+typedef struct flshm_message_view {
+	/**
+	 * The tick timestamp for the message.
+	 */
+	uint32_t tick;
+	/**
+	 * The length of all of the AMF data.
+	 */
+	uint32_t amfl;
+	/**
+	 * The sending connection name.
+	 */
+	flshm_string name;
+	/**
+	 * The sending conneciton host.
+	 */
+	flshm_string host;
+	/**
+	 * What version the message format is.
+	 */
+	flshm_version version;
+	/**
+	 * A flag for if sandboxed.
+	 * FLSHM_VERSION_2+
+	 */
+	bool sandboxed;
+	/**
+	 * A flag for if sending origin is using HTTPS.
+	 * FLSHM_VERSION_2+
+	 */
+	bool https;
+	/**
+	 * The sender security sandbox.
+	 * FLSHM_VERSION_3+
+	 */
+	flshm_security sandbox;
+	/**
+	 * The sender SWF version.
+	 * FLSHM_VERSION_3+
+	 */
+	uint32_t swfv;
+	/**
+	 * The filepath of the sender for local-with-file sandbox.
+	 * FLSHM_VERSION_3+ and sandbox == FLSHM_SECURITY_LOCAL_WITH_FILE
+	 */
+	flshm_string filepath;
+	/**
+	 * The AMF version the message data is encoded with.
+	 * FLSHM_VERSION_4+
+	 */
+	flshm_amf amfv;
+	/**
+	 * The method name to be called in by the reciever.
+	 */
+	flshm_string method;
+	/**
+	 * The size of the message arguments data.
+	 */
+	uint32_t size;
+	/**
+	 * The message data for the arguments, encoded in AMF format in amfv.
+	 */
+	const void * data;
+} flshm_message_view;
 
 
 /**
- * Lock the semaphore for the shared memory.
- * Useful for obtaining exclusive access, to avoid any race conditions.
+ * A fragment of message data, for writing data without concatenating it.
  */
-bool flshm_lock(flshm_info * info);
+typedef struct flshm_iovec {
+	/**
+	 * The fragment data.
+	 */
+	const void * data;
+	/**
+	 * The size of the fragment data.
+	 */
+	uint32_t size;
+} flshm_iovec;
 
 
 /**
- * Unlock the semaphore for the shared memory.
+ * A filter for messages sent to a list of connection names.
  */
-bool flshm_unlock(flshm_info * info);
+typedef struct flshm_message_filter {
+	/**
+	 * The connection names, NULL to match any message.
+	 */
+	const char ** names;
+	/**
+	 * The number of connection names.
+	 */
+	uint32_t count;
+	/**
+	 * A message tick to ignore, like the last one read, 0 for none.
+	 */
+	uint32_t ignore;
+} flshm_message_filter;
 
 
 /**
- * Check if connection name is valid.
+ * The strategy used to wait for a message.
+ * Polls busy spinning, then yielding, then sleeping with exponential backoff.
  */
-bool flshm_connection_name_valid(const char * name);
+typedef struct flshm_wait_strategy {
+	/**
+	 * The number of times to poll busy spinning.
+	 */
+	uint32_t spins;
+	/**
+	 * The number of times to poll yielding the thread.
+	 */
+	uint32_t yields;
+	/**
+	 * The first sleep in microseconds, doubled each time.
+	 */
+	uint32_t sleep_min;
+	/**
+	 * The longest sleep in microseconds.
+	 */
+	uint32_t sleep_max;
+} flshm_wait_strategy;
 
 
 /**
- * List all registered connecitons.
- * Listed connection names point directly to the string in the shared memory.
- * These strings can change anytime by another instance once unlocked.
+ * The status of a message written only if no message is pending.
  */
-flshm_connected flshm_connection_list(flshm_info * info);
+typedef struct flshm_write_status {
+	/**
+	 * The result.
+	 */
+	flshm_write_result result;
+	/**
+	 * The tick of the pending message if busy, else 0.
+	 */
+	uint32_t tick;
+	/**
+	 * The milliseconds since the tick of the pending message if busy, else 0.
+	 */
+	uint32_t age;
+} flshm_write_status;
 
 
 /**
- * Add a connection to the list of registered connections.
+ * The status of a message sent and waited on.
  */
-bool flshm_connection_add(flshm_info * info, flshm_connection connection);
+typedef struct flshm_send_status {
+	/**
+	 * The result.
+	 */
+	flshm_send_result result;
+	/**
+	 * The tick the message was sent with.
+	 */
+	uint32_t tick;
+	/**
+	 * The milliseconds from writing until received, replaced, or timed out.
+	 */
+	uint32_t latency;
+} flshm_send_status;
 
 
 /**
- * Remove a connection from the list of registerd connections.
+ * A message reader, decoding into a reusable buffer to avoid allocations.
  */
-bool flshm_connection_remove(flshm_info * info, flshm_connection connection);
+typedef struct flshm_reader {
+	/**
+	 * The last message read, strings and data point into the buffer.
+	 */
+	flshm_message message;
+	/**
+	 * The buffer messages are decoded into, grown as needed.
+	 */
+	char * buffer;
+	/**
+	 * The allocated size of the buffer.
+	 */
+	uint32_t buffer_size;
+} flshm_reader;
 
 
 /**
- * Read the current message tick.
- * Returns 0 if tick is not set.
+ * A message sender, with the header encoded once for repeated sends.
  */
-uint32_t flshm_message_tick(flshm_info * info);
+typedef struct flshm_sender {
+	/**
+	 * The encoded header, everything before the method.
+	 */
+	char * header;
+	/**
+	 * The size of the encoded header.
+	 */
+	uint32_t header_size;
+} flshm_sender;
 
 
 /**
- * Free the memory returned from flshm_message_read.
+ * A watcher, polling the shared memory from a thread for events.
+ * Everything after the fd member is platform specific.
  */
-void flshm_message_free(flshm_message * message);
-
-
+typedef struct flshm_watcher {
+	/**
+	 * The info being watched.
+	 */
+	flshm_info * info;
+	/**
+	 * The connection names to report messages for.
+	 */
+	char ** names;
+	/**
+	 * The number of connection names.
+	 */
+	uint32_t count;
+	/**
+	 * The polling interval in milliseconds.
+	 */
+	uint32_t interval;
+	/**
+	 * Flag for the thread to keep running, accessed atomically.
+	 */
+	uint32_t running;
+	/**
+	 * The events reported and not yet read, accessed atomically.
+	 */
+	uint32_t events;
+	/**
+	 * The last message tick seen by the thread.
+	 */
+	uint32_t tick;
+	/**
+	 * The last connection list seen by the thread.
+	 */
+	flshm_connections_snapshot connections;
+
+#ifdef _WIN32
+
+	/**
+	 * Event signaled when events are reported, to wait on in an event loop.
+	 */
+	HANDLE fd;
+	HANDLE thread;
+
+#elif __APPLE__
+
+	/**
+	 * Pipe readable when events are reported, to poll in an event loop.
+	 */
+	int fd;
+	int fd_write;
+	pthread_t thread;
+
+#else
+
+	/**
+	 * Eventfd readable when events are reported, to poll in an event loop.
+	 */
+	int fd;
+	pthread_t thread;
+
+#endif
+
+} flshm_watcher;
+
+
+/**
+ * A handler for messages routed by a multiplexer.
+ * The method is the rest of the message method after the prefix.
+ */
+typedef void (* flshm_mux_handler)(
+	flshm_message * message,
+	const char * method,
+	void * context
+);
+
+
+/**
+ * A multiplexer route, from a method prefix to a handler.
+ */
+typedef struct flshm_mux_route {
+	/**
+	 * The method prefix, NULL if the slot is empty.
+	 */
+	char * prefix;
+	/**
+	 * The length of the method prefix.
+	 */
+	uint32_t size;
+	/**
+	 * The hash of the method prefix.
+	 */
+	uint32_t hash;
+	/**
+	 * The handler called for messages routed here.
+	 */
+	flshm_mux_handler handler;
+	/**
+	 * The context passed to the handler.
+	 */
+	void * context;
+} flshm_mux_route;
+
+
+/**
+ * A multiplexer, routing messages for one connection to many endpoints.
+ * Messages are routed by the method prefix, up to the separator.
+ */
+typedef struct flshm_mux {
+	/**
+	 * The connection to register, the name is owned by the multiplexer.
+	 */
+	flshm_connection connection;
+	/**
+	 * The character separating the method prefix from the rest.
+	 */
+	char separator;
+	/**
+	 * The routes hash table, open addressing.
+	 */
+	flshm_mux_route * routes;
+	/**
+	 * The size of the routes hash table, a power of 2.
+	 */
+	uint32_t capacity;
+	/**
+	 * The number of routes.
+	 */
+	uint32_t count;
+} flshm_mux;
+
+
+/**
+ * A subscriber callback for connection list changes.
+ * The connection name is only valid during the call.
+ */
+typedef void (* flshm_feed_callback)(
+	flshm_feed_change change,
+	const flshm_connection * connection,
+	void * context
+);
+
+
+/**
+ * A connection feed subscriber.
+ */
+typedef struct flshm_feed_subscriber {
+	/**
+	 * The callback to call for each change.
+	 */
+	flshm_feed_callback callback;
+	/**
+	 * The context passed to the callback.
+	 */
+	void * context;
+} flshm_feed_subscriber;
+
+
+/**
+ * A connection feed, reporting connections added and removed to subscribers.
+ * Keeps the last connection list seen, to diff it once for all subscribers.
+ */
+typedef struct flshm_feed {
+	/**
+	 * The last connections seen, the names are owned by the feed.
+	 */
+	flshm_connected connected;
+	/**
+	 * The lengths of the connection names.
+	 */
+	uint32_t sizes[FLSHM_CONNECTIONS_MAX_COUNT];
+	/**
+	 * The subscribers.
+	 */
+	flshm_feed_subscriber * subscribers;
+	/**
+	 * The number of subscribers.
+	 */
+	uint32_t count;
+	/**
+	 * The number of subscribers allocated for.
+	 */
+	uint32_t capacity;
+	/**
+	 * The connection list seen on the last update.
+	 */
+	flshm_connections_snapshot snapshot;
+} flshm_feed;
+
+
+/**
+ * A member of a shard group, a connection sharing the naming prefix.
+ */
+typedef struct flshm_shard_member {
+	/**
+	 * The connection, the name is owned by the shard group.
+	 */
+	flshm_connection connection;
+	/**
+	 * The length of the connection name.
+	 */
+	uint32_t size;
+	/**
+	 * The hash of the connection name.
+	 */
+	uint32_t hash;
+} flshm_shard_member;
+
+
+/**
+ * A shard group, the connections whose names start with a common prefix.
+ * Keys are assigned to members by rendezvous hashing, so a member joining or
+ * leaving only moves the keys assigned to that member.
+ */
+typedef struct flshm_shard {
+	/**
+	 * The naming prefix of the members, owned by the shard group.
+	 */
+	char * prefix;
+	/**
+	 * The length of the naming prefix.
+	 */
+	uint32_t prefix_size;
+	/**
+	 * The members found on the last refresh.
+	 */
+	flshm_shard_member members[FLSHM_CONNECTIONS_MAX_COUNT];
+	/**
+	 * The number of members.
+	 */
+	uint32_t count;
+	/**
+	 * The connection list seen on the last refresh.
+	 */
+	flshm_connections_snapshot snapshot;
+} flshm_shard;
+
+
+
+
+/**
+ * Generate a message tick.
+ * Based on current time, but can return 0 in theory.
+ */
+uint32_t flshm_tick();
+
+
+/**
+ * Generate a message tick, greater than the last one for the same info.
+ * Based on current time, but one more than the last if it has not advanced.
+ * Never returns 0, safe to call from multiple threads.
+ */
+uint32_t flshm_tick_next(flshm_info * info);
+
+
+/**
+ * Get the keys to open a connection with.
+ * is_per_user has same functionality of the ASVM isPerUser.
+ * Should be set to match the ASVM targeted.
+ */
+flshm_keys flshm_get_keys(bool is_per_user);
+
+
+/**
+ * Open the semaphores and shared memory.
+ * is_per_user has same functionality of the ASVM isPerUser.
+ * Should be set to match the ASVM targeted.
+ */
+flshm_info * flshm_open(bool is_per_user);
+
+
+/**
+ * Close the semaphores and shared memory, freeing memory.
+ */
+void flshm_close(flshm_info * info);
+
+
+/**
+ * Lock the semaphore for the shared memory.
+ * Useful for obtaining exclusive access, to avoid any race conditions.
+ */
+bool flshm_lock(flshm_info * info);
+
+
+/**
+ * Try to lock the semaphore for the shared memory, without waiting.
+ * Returns FLSHM_LOCK_BUSY if already locked.
+ */
+flshm_lock_status flshm_trylock(flshm_info * info);
+
+
+/**
+ * Lock the semaphore for the shared memory, waiting up to the timeout.
+ * The timeout is in milliseconds.
+ * Returns FLSHM_LOCK_TIMEOUT if still locked at the timeout.
+ */
+flshm_lock_status flshm_lock_timed(flshm_info * info, uint32_t timeout);
+
+
+/**
+ * Unlock the semaphore for the shared memory.
+ */
+bool flshm_unlock(flshm_info * info);
+
+
+/**
+ * Check if connection name is valid.
+ */
+bool flshm_connection_name_valid(const char * name);
+
+
+/**
+ * Get the length of a connection name, validating it in the same scan.
+ * Returns 0 if the name is invalid.
+ */
+uint32_t flshm_connection_name_length(const char * name);
+
+
+/**
+ * List all registered connecitons.
+ * Listed connection names point directly to the string in the shared memory.
+ * These strings can change anytime by another instance once unlocked.
+ * The list is cached, and only parsed again if the memory has changed.
+ */
+flshm_connected flshm_connection_list(flshm_info * info);
+
+
+/**
+ * Find a registered connection by name, stopping at the first match.
+ * Sets the entry to the connection and where it is in the memory if found.
+ */
+bool flshm_connection_find(
+	flshm_info * info,
+	const char * name,
+	flshm_connection_entry * entry
+);
+
+
+/**
+ * Add a connection to the list of registered connections.
+ */
+bool flshm_connection_add(flshm_info * info, flshm_connection connection);
+
+
+/**
+ * Add multiple connections to the list of registered connections at once.
+ * Sets the status of each connection in statuses, same size as connections.
+ * Returns the number of connections added.
+ */
+uint32_t flshm_connection_add_many(
+	flshm_info * info,
+	const flshm_connection * connections,
+	uint32_t count,
+	flshm_connection_status * statuses
+);
+
+
+/**
+ * Remove a connection from the list of registerd connections.
+ */
+bool flshm_connection_remove(flshm_info * info, flshm_connection connection);
+
+
+/**
+ * Remove a connection entry in place, as found by flshm_connection_find.
+ * Only while the lock is held, with the list unchanged since it was found.
+ * Returns false if the entry is not inside the list.
+ */
+bool flshm_connection_remove_entry(
+	flshm_info * info,
+	const flshm_connection_entry * entry
+);
+
+
+/**
+ * Read the current message tick.
+ * Returns 0 if tick is not set.
+ */
+uint32_t flshm_message_tick(flshm_info * info);
+
+
+/**
+ * Check for a message without locking, using ordered reads.
+ * Returns the message tick, or 0 if no message is present.
+ * Lock and read the message only when this changes.
+ */
+uint32_t flshm_message_pending(flshm_info * info);
+
+
+/**
+ * Get the default strategy for flshm_message_wait.
+ */
+flshm_wait_strategy flshm_wait_strategy_default();
+
+
+/**
+ * Wait without locking for a message matching the filter, or the deadline.
+ * The filter and strategy are optional, NULL for any message or the default.
+ * The deadline is a tick from flshm_tick.
+ * The number of times the wait woke up to poll is set in wakeups if not NULL.
+ * Returns the message tick, or 0 if the deadline was reached.
+ * The message may change before locked, read it with flshm_message_read_for.
+ */
+uint32_t flshm_message_wait(
+	flshm_info * info,
+	const flshm_message_filter * filter,
+	uint32_t deadline,
+	const flshm_wait_strategy * strategy,
+	uint32_t * wakeups
+);
+
+
+/**
+ * Free the memory returned from flshm_message_read.
+ */
+void flshm_message_free(flshm_message * message);
+
+
 /**
  * Read a message from shared memory.
  */
 flshm_message * flshm_message_read(flshm_info * info);
 
 
+/**
+ * Read a message from shared memory without allocating or copying.
+ * Returns false if no valid message is present.
+ * The view points into the shared memory, only valid while locked.
+ */
+bool flshm_message_read_view(flshm_info * info, flshm_message_view * view);
+
+
+/**
+ * Read a message from shared memory, only if sent to one of the names.
+ * The destination name is checked in place before decoding anything.
+ * Returns NULL if no valid message is present, or is for another name.
+ */
+flshm_message * flshm_message_read_for(
+	flshm_info * info,
+	const char ** names,
+	uint32_t count
+);
+
+
+/**
+ * Create a message reader, with a buffer for the largest possible message.
+ */
+flshm_reader * flshm_reader_create();
+
+
+/**
+ * Free a message reader, including the last message read.
+ */
+void flshm_reader_free(flshm_reader * reader);
+
+
+/**
+ * Read a message from shared memory into the reader buffer.
+ * The returned message is owned by the reader, do not flshm_message_free it.
+ * It remains valid until the next read or until the reader is freed.
+ */
+flshm_message * flshm_reader_read(flshm_reader * reader, flshm_info * info);
+
+
+/**
+ * Read a message into the reader buffer, only if sent to one of the names.
+ * Same as flshm_message_read_for, but owned by the reader.
+ */
+flshm_message * flshm_reader_read_for(
+	flshm_reader * reader,
+	flshm_info * info,
+	const char ** names,
+	uint32_t count
+);
+
+
 /**
  * Write a message to shared memory.
  */
 bool flshm_message_write(flshm_info * info, flshm_message * message);
 
 
+/**
+ * Write a message to shared memory, with the data in fragments.
+ * The fragments are copied in order, the message data and size are ignored.
+ */
+bool flshm_message_writev(
+	flshm_info * info,
+	flshm_message * message,
+	const flshm_iovec * iov,
+	uint32_t iovcnt
+);
+
+
+/**
+ * Create a message sender, validating and encoding the header once.
+ * Uses all the message properties but the tick, method, and data.
+ * Returns NULL if the header is invalid.
+ */
+flshm_sender * flshm_sender_create(flshm_message * message);
+
+
+/**
+ * Free a message sender.
+ */
+void flshm_sender_free(flshm_sender * sender);
+
+
+/**
+ * Write a message to shared memory, using the sender header.
+ */
+bool flshm_sender_write(
+	flshm_sender * sender,
+	flshm_info * info,
+	uint32_t tick,
+	const char * method,
+	const void * data,
+	uint32_t size
+);
+
+
+/**
+ * Write a message to shared memory, using the sender header.
+ * The data fragments are copied in order.
+ */
+bool flshm_sender_writev(
+	flshm_sender * sender,
+	flshm_info * info,
+	uint32_t tick,
+	const char * method,
+	const flshm_iovec * iov,
+	uint32_t iovcnt
+);
+
+
+/**
+ * Write message to shared memory, only if no message is pending.
+ * Unlike flshm_message_write, never replaces a message not yet received.
+ * Only call while the lock is held.
+ * The status is set if not NULL, with the pending message tick and age.
+ * Returns true if written.
+ */
+bool flshm_message_try_write(
+	flshm_info * info,
+	flshm_message * message,
+	flshm_write_status * status
+);
+
+
 /**
  * Clear the message by erasing tick and size.
  */
 void flshm_message_clear(flshm_info * info);
 
+
+/**
+ * Send a message, and wait for it to be received or the timeout in ms.
+ * Locks to write, then waits without the lock until the tick is cleared.
+ * If not received in time, clears it to free the memory for others.
+ * Only call while not holding the lock.
+ * If the message tick is 0, one is generated with flshm_tick_next.
+ * The status is set if not NULL.
+ * A message replaced, and that one received, between polls is delivered.
+ * Returns true if delivered.
+ */
+bool flshm_message_send(
+	flshm_info * info,
+	flshm_message * message,
+	uint32_t timeout,
+	flshm_send_status * status
+);
+
+
+/**
+ * Open a watcher, polling from a thread every interval in milliseconds.
+ * Reports FLSHM_WATCH_MESSAGE for messages to one of the names (any if none).
+ * Reports FLSHM_WATCH_CONNECTIONS when the connection list changes.
+ * The info must remain open until the watcher is closed.
+ * Returns NULL on failure.
+ */
+flshm_watcher * flshm_watcher_open(
+	flshm_info * info,
+	const char ** names,
+	uint32_t count,
+	uint32_t interval
+);
+
+
+/**
+ * Stop and close a watcher, freeing memory.
+ */
+void flshm_watcher_close(flshm_watcher * watcher);
+
+
+/**
+ * Get and clear the reported events, resetting the fd.
+ * Returns the flshm_watch_event flags reported since last called.
+ */
+uint32_t flshm_watcher_events(flshm_watcher * watcher);
+
+
+/**
+ * Create a multiplexer for a connection, routing by method prefix.
+ * Register it with flshm_mux_register, and read messages for its name.
+ * Returns NULL if the connection name is invalid.
+ */
+flshm_mux * flshm_mux_create(flshm_connection connection, char separator);
+
+
+/**
+ * Free a multiplexer, including its routes.
+ */
+void flshm_mux_free(flshm_mux * mux);
+
+
+/**
+ * Register the connection of a multiplexer in the connection list.
+ * Only call while the lock is held.
+ * Returns false if it could not be added, like flshm_connection_add.
+ */
+bool flshm_mux_register(flshm_mux * mux, flshm_info * info);
+
+
+/**
+ * Remove the connection of a multiplexer from the connection list.
+ * Only call while the lock is held.
+ * Returns false if it was not registered.
+ */
+bool flshm_mux_unregister(flshm_mux * mux, flshm_info * info);
+
+
+/**
+ * Add a route from a method prefix to a handler.
+ * Returns false if the prefix is already routed.
+ */
+bool flshm_mux_route_add(
+	flshm_mux * mux,
+	const char * prefix,
+	flshm_mux_handler handler,
+	void * context
+);
+
+
+/**
+ * Remove the route for a method prefix.
+ * Returns false if the prefix is not routed.
+ */
+bool flshm_mux_route_remove(flshm_mux * mux, const char * prefix);
+
+
+/**
+ * Dispatch a message to the handler routed for its method prefix.
+ * Returns false if not for the connection, or no route matches.
+ */
+bool flshm_mux_dispatch(flshm_mux * mux, flshm_message * message);
+
+
+/**
+ * Create a shard group for connections with names starting with a prefix.
+ * Call flshm_shard_refresh to discover the members.
+ */
+flshm_shard * flshm_shard_create(const char * prefix);
+
+
+/**
+ * Free a shard group, including the member names.
+ */
+void flshm_shard_free(flshm_shard * shard);
+
+
+/**
+ * Refresh the members from the connection list, cheap if unchanged.
+ * Only call while the lock is held.
+ * Returns true if members joined or left.
+ */
+bool flshm_shard_refresh(flshm_shard * shard, flshm_info * info);
+
+
+/**
+ * Pick the member to send a key to, the same while the members are.
+ * Returns NULL if there are no members.
+ */
+const flshm_shard_member * flshm_shard_pick(
+	flshm_shard * shard,
+	const char * key,
+	uint32_t size
+);
+
+
+/**
+ * Open the sidecar shared memory recording connection owners, creating it.
+ * The is_per_user argument selects the same memory as for flshm_open.
+ * Only use the records while the lock on the main memory is held.
+ * Returns NULL on failure.
+ */
+flshm_owners * flshm_owners_open(bool is_per_user);
+
+
+/**
+ * Close the sidecar shared memory, and free the info.
+ */
+void flshm_owners_close(flshm_owners * owners);
+
+
+/**
+ * Record this process as the owner of a connection name, with a heartbeat.
+ * Call after adding the connection, while the lock is held.
+ * Returns false if the name is too long, or all the records are used.
+ */
+bool flshm_owners_claim(flshm_owners * owners, const char * name);
+
+
+/**
+ * Update the heartbeat tick of a connection name owned by this process.
+ * Returns false if not owned by this process.
+ */
+bool flshm_owners_heartbeat(flshm_owners * owners, const char * name);
+
+
+/**
+ * Forget the owner of a connection name owned by this process.
+ * Call when removing the connection, while the lock is held.
+ * Returns false if not owned by this process.
+ */
+bool flshm_owners_release(flshm_owners * owners, const char * name);
+
+
+/**
+ * Remove connections whose owner process has died in one pass.
+ * With a non-zero timeout, also those without a heartbeat for that many ms.
+ * Connections without an owner record, like Flash Player's, are kept.
+ * Only call while the lock is held.
+ * Returns the number of connections removed.
+ */
+uint32_t flshm_owners_reap(
+	flshm_owners * owners,
+	flshm_info * info,
+	uint32_t timeout
+);
+
+
+/**
+ * Create a connection feed, starting from an empty connection list.
+ * The first update reports every registered connection as added.
+ */
+flshm_feed * flshm_feed_create(void);
+
+
+/**
+ * Free a connection feed, without calling the subscribers.
+ */
+void flshm_feed_free(flshm_feed * feed);
+
+
+/**
+ * Subscribe a callback, with a context, to the changes.
+ */
+void flshm_feed_subscribe(
+	flshm_feed * feed,
+	flshm_feed_callback callback,
+	void * context
+);
+
+
+/**
+ * Unsubscribe a callback, with the same context it was subscribed with.
+ * Returns false if not subscribed.
+ */
+bool flshm_feed_unsubscribe(
+	flshm_feed * feed,
+	flshm_feed_callback callback,
+	void * context
+);
+
+
+/**
+ * Update from the connection list, cheap if unchanged.
+ * Reports each connection removed, then added, to every subscriber.
+ * A connection registered again with a different version or sandbox is both.
+ * Only call while the lock is held, like when a watcher reports a change.
+ * Returns the number of changes.
+ */
+uint32_t flshm_feed_update(flshm_feed * feed, flshm_info * info);
+
 #endif
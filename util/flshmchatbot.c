@@ -4,7 +4,6 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
-#include <time.h>
 
 #include <flshm.h>
 
@@ -118,18 +117,37 @@ void strinv(char * s) {
 }
 
 static flshm_info * info = NULL;
+static flshm_owners * owners = NULL;
+static flshm_reader * reader = NULL;
 static flshm_connection connection = { NULL, 0, 0 };
 static bool locked = false;
 
 static void onshutdown(int signo) {
 	printf("\nCleaning up...\n");
 	if (info) {
-		if (!locked && connection.name) {
-			flshm_lock(info);
-			flshm_connection_remove(info, connection);
+
+		// Lock unless already, but flshm_message_send may hold the lock if
+		// it was interrupted, so give up after a while instead of deadlock.
+		if (locked || flshm_lock_timed(info, 1000) == FLSHM_LOCK_ACQUIRED) {
+			if (connection.name) {
+				flshm_connection_remove(info, connection);
+				if (owners) {
+					flshm_owners_release(owners, connection.name);
+				}
+			}
+			flshm_unlock(info);
+			flshm_close(info);
 		}
-		flshm_unlock(info);
-		flshm_close(info);
+		else {
+			// Closing would lock too, leave the name to be reaped.
+			printf("FAILED: flshm_lock_timed\n");
+		}
+	}
+	if (owners) {
+		flshm_owners_close(owners);
+	}
+	if (reader) {
+		flshm_reader_free(reader);
 	}
 	printf("Shutting down...\n");
 	exit(signo == SIGINT ? EXIT_SUCCESS : EXIT_FAILURE);
@@ -184,133 +202,172 @@ int main(int argc, char ** argv) {
 		return EXIT_FAILURE;
 	}
 
+	// Record owners, so a killed chatbot does not keep its name registered.
+	owners = flshm_owners_open(is_per_user);
+	if (!owners) {
+		printf("FAILED: flshm_owners_open\n");
+	}
+
 	// Register the connection name or fail.
 	flshm_lock(info);
+	if (owners) {
+		flshm_owners_reap(owners, info, 0);
+	}
 	connection.name = connection_name_self;
 	connection.version = FLSHM_VERSION_3;
 	connection.sandbox = FLSHM_SECURITY_LOCAL_TRUSTED;
 	if (!flshm_connection_add(info, connection)) {
 		printf("FAILED: flshm_connection_add\n");
 		flshm_unlock(info);
+		if (owners) {
+			flshm_owners_close(owners);
+		}
 		flshm_close(info);
 		return EXIT_FAILURE;
 	}
+	if (owners) {
+		flshm_owners_claim(owners, connection.name);
+	}
 	flshm_unlock(info);
 
+	// Reuse one reader for every message, to avoid allocations.
+	reader = flshm_reader_create();
+	const char * names[] = { connection_name_self };
+
 	printf("Chatbot runnning...\n");
 
+	// Wait for messages to this, ignoring the last one handled.
+	flshm_message_filter filter;
+	filter.names = names;
+	filter.count = 1;
+	filter.ignore = 0;
+
 	// Run loop.
 	while (true) {
+
+		// Wait for a message without locking, with the default backoff.
+		uint32_t tick_pending = flshm_message_wait(
+			info,
+			&filter,
+			flshm_tick() + 1000,
+			NULL,
+			NULL
+		);
+		if (!tick_pending) {
+			continue;
+		}
+		filter.ignore = tick_pending;
+
 		flshm_lock(info);
 		locked = true;
 
-		// Read message if present.
-		flshm_message * message = flshm_message_read(info);
+		// Read message if present, and intended for this.
+		flshm_message * message = flshm_reader_read_for(
+			reader,
+			info,
+			names,
+			1
+		);
+
+		// Clear the message from the memory, then unlock to respond.
+		if (message) {
+			flshm_message_clear(info);
+		}
+		flshm_unlock(info);
+		locked = false;
+
 		if (message) {
 
-			// Check that this message is intended for this.
-			if (!strcmp(connection_name_self, message->name)) {
+			// Show debug info for the message.
+			if (debug) {
+				dump_message(message);
+			}
 
-				// Clear the message from the memory.
-				flshm_message_clear(info);
+			// Read the data as AMF0 string if possible.
+			char * msgstr = NULL;
+			if (amf0_read_string(&msgstr, message->data, message->size)) {
 
-				// Show debug info for the message.
-				if (debug) {
-					dump_message(message);
-				}
+				// Print the parsed string.
+				printf("Received: %s\n", msgstr);
 
-				// Read the data as AMF0 string if possible.
-				char * msgstr = NULL;
-				if (amf0_read_string(&msgstr, message->data, message->size)) {
+				// Invert the character cases.
+				strinv(msgstr);
 
-					// Print the parsed string.
-					printf("Received: %s\n", msgstr);
+				// Generate a tick for this, again if same as the message.
+				uint32_t tick = flshm_tick_next(info);
+				if (tick == message->tick) {
+					tick = flshm_tick_next(info);
+				}
 
-					// Invert the character cases.
-					strinv(msgstr);
+				// Create a buffer for the data, and write to it.
+				uint32_t max = 3 + strlen(msgstr);
+				char * data = malloc(max);
+				uint32_t size;
+				if ((size = amf0_write_string(msgstr, data, max))) {
+
+					// Create a new filepath from the existing one.
+					char * filepath = NULL;
+					if (message->filepath) {
+						uint32_t fpl = strlen(message->filepath);
+						char append[] = ".chatbot.swf";
+						filepath = malloc(fpl + sizeof(append));
+						memcpy(filepath, message->filepath, fpl);
+						memcpy(filepath + fpl, append, sizeof(append));
+					}
 
-					// Generate tick, loop if still same.
-					uint32_t tick;
-					do {
-						tick = flshm_tick();
+					// Create the response data, mimick sender.
+					flshm_message response;
+					response.tick = tick;
+					response.name = connection_name_peer;
+					response.host = message->host;
+					response.version = message->version;
+					response.sandboxed = message->sandboxed;
+					response.https = message->https;
+					response.sandbox = message->sandbox;
+					response.swfv = message->swfv;
+					response.filepath = filepath;
+					response.amfv = FLSHM_AMF0;
+					response.method = message->method;
+					response.data = data;
+					response.size = size;
+
+					// Send the message, and wait for it to be received.
+					// If not received in a second, it is erased to free.
+					flshm_send_status status;
+					if (!flshm_message_send(info, &response, 1000, &status)) {
+						printf(
+							"FAILED: flshm_message_send: %i\n",
+							status.result
+						);
 					}
-					while (tick == message->tick);
-
-					// Create a buffer for the data, and write to it.
-					uint32_t max = 3 + strlen(msgstr);
-					char * data = malloc(max);
-					uint32_t size;
-					if ((size = amf0_write_string(msgstr, data, max))) {
-
-						// Create a new filepath from the existing one.
-						char * filepath = NULL;
-						if (message->filepath) {
-							uint32_t fpl = strlen(message->filepath);
-							char append[] = ".chatbot.swf";
-							filepath = malloc(fpl + sizeof(append));
-							memcpy(filepath, message->filepath, fpl);
-							memcpy(filepath + fpl, append, sizeof(append));
-						}
-
-						// Create the response data, mimick sender.
-						flshm_message response;
-						response.tick = tick;
-						response.name = connection_name_peer;
-						response.host = message->host;
-						response.version = message->version;
-						response.sandboxed = message->sandboxed;
-						response.https = message->https;
-						response.sandbox = message->sandbox;
-						response.swfv = message->swfv;
-						response.filepath = filepath;
-						response.amfv = FLSHM_AMF0;
-						response.method = message->method;
-						response.data = data;
-						response.size = size;
-
-						// Write the message to shared memory.
-						// In theory, should poll the tick to ensure is read.
-						// If not read in set timout, then erase to free.
-						if (!flshm_message_write(info, &response)) {
-							printf("FAILED: flshm_message_write\n");
-						}
-
-						// Show debug info for the response.
-						if (debug) {
-							dump_message(&response);
-						}
-
-						// Print the response string.
-						printf("Response: %s\n", msgstr);
-
-						// Free filepath if allocated.
-						if (filepath) {
-							free(filepath);
-						}
+
+					// Show debug info for the response.
+					if (debug) {
+						dump_message(&response);
 					}
 
-					// Free the data buffer.
-					free(data);
+					// Print the response string.
+					printf("Response: %s (%u ms)\n", msgstr, status.latency);
 
-					// Free the parsed string.
-					free(msgstr);
+					// Free filepath if allocated.
+					if (filepath) {
+						free(filepath);
+					}
 				}
-			}
-
-			// Free the memory from the message.
-			flshm_message_free(message);
-		}
 
-		flshm_unlock(info);
-		locked = false;
+				// Free the data buffer.
+				free(data);
 
-		struct timespec tim;
-		struct timespec tim2;
-		tim.tv_sec = 0;
-		tim.tv_nsec = 10000000L;
-		nanosleep(&tim, &tim2);
+				// Free the parsed string.
+				free(msgstr);
+			}
+		}
 	}
 
+	flshm_reader_free(reader);
+	if (owners) {
+		flshm_owners_close(owners);
+	}
 	flshm_close(info);
 
 	return EXIT_SUCCESS;
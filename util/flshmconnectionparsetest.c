@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <flshm.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__))
+	// The scan kernels are private, but linked in, select each to test.
+	#define SCAN_X86
+	uint32_t flshm_scan_scalar(const char * p, uint32_t size, char a, char b);
+	uint32_t flshm_scan_sse2(const char * p, uint32_t size, char a, char b);
+	uint32_t flshm_scan_avx2(const char * p, uint32_t size, char a, char b);
+	extern uint32_t (* flshm_scan_selected)(const char *, uint32_t, char, char);
+#endif
+
+// The previous name validator, one character at a time.
+bool legacy_connection_name_valid(const char * name) {
+
+	// First character must not be ':'.
+	if (name[0] == ':') {
+		return false;
+	}
+
+	// Check how many colons are expected, and keep track of those seen.
+	uint8_t colons_valid = name[0] == '_' ? 0 : 1;
+	uint8_t colons = 0;
+	for (uint32_t i = 0; true; i++) {
+
+		// Check if too large.
+		if (i >= 0xFFFF) {
+			return false;
+		}
+
+		char c = name[i];
+
+		// If null, end of the string.
+		if (c == '\0') {
+			// Must have length and not end in ':'.
+			if (i == 0 || name[i - 1] == ':') {
+				return false;
+			}
+			break;
+		}
+
+		// If colon, make sure not more than expected.
+		if (c == ':') {
+			if (colons >= colons_valid) {
+				return false;
+			}
+			colons++;
+		}
+	}
+
+	// If saw the expected colon count, return valid.
+	return colons == colons_valid;
+}
+
+// The previous scalar parser, the reference for the current one.
+flshm_connected legacy_connection_list(flshm_info * info) {
+
+	// Initialize the connected object.
+	flshm_connected connected;
+	connected.count = 0;
+
+	// Initialize a connection struct to all empty values.
+	flshm_connection connection;
+	connection.name = NULL;
+	connection.version = FLSHM_VERSION_1;
+	connection.sandbox = FLSHM_SECURITY_NONE;
+
+	// Map out the memory, and loop over them.
+	char * memory = ((char *)info->data) + FLSHM_CONNECTIONS_OFFSET;
+	for (uint32_t i = 0; i < FLSHM_CONNECTIONS_SIZE; i++) {
+
+		// Get pointer to memory and the character that appears there.
+		char * p = memory + i;
+		char pc = *p;
+
+		// Unexpected null byte terminates the list.
+		if (pc == '\0') {
+			break;
+		}
+		else if (pc == ':') {
+
+			// Check if matches "::[^\x00]\x00" in the remaining space.
+			if (
+				i < FLSHM_CONNECTIONS_SIZE - 3 &&
+				*(p + 1) == ':' &&
+				*(p + 2) != '\0' &&
+				*(p + 3) == '\0'
+			) {
+				// Check that we are still parsing a connection.
+				if (connection.name) {
+					unsigned char c = *(p + 2);
+
+					// Set version then sandbox, '0' then '1' indexed.
+					if (connection.version == FLSHM_VERSION_1) {
+						connection.version = c - (uint8_t)'0';
+					}
+					else if (connection.sandbox == FLSHM_SECURITY_NONE) {
+						connection.sandbox = c - (uint8_t)'1';
+					}
+				}
+				i += 3;
+			}
+			else {
+
+				// Otherwise seek until the next null or end.
+				for (; i < FLSHM_CONNECTIONS_SIZE; i++) {
+					if (*(memory + i) == '\0') {
+						break;
+					}
+				}
+			}
+		}
+		else {
+
+			// If currently has an open connection, store it, and reset.
+			if (connection.name) {
+				connected.connections[connected.count++] = connection;
+				connection.name = NULL;
+				connection.version = FLSHM_VERSION_1;
+				connection.sandbox = FLSHM_SECURITY_NONE;
+				// Stop if reached the maximum connections.
+				if (connected.count >= FLSHM_CONNECTIONS_MAX_COUNT) {
+					break;
+				}
+			}
+
+			// Seek out the null in the remaining memory.
+			for (; i < FLSHM_CONNECTIONS_SIZE; i++) {
+				if (*(memory + i) == '\0') {
+					// If nulled and valid, set name.
+					if (legacy_connection_name_valid(p)) {
+						connection.name = p;
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	// Store the last connection if not yet stored.
+	if (connection.name) {
+		connected.connections[connected.count++] = connection;
+	}
+
+	return connected;
+}
+
+// Fill the list with random entries, some valid, some not, some garbage.
+void generate(char * memory, uint32_t i) {
+
+	static const char * tokens[] = {
+		"localhost:a", "_b", "example.com:cc", "bad", ":x", "::3", "::4",
+		"::", "::12", "a:b:c", "_x:", "", "::5", "_q", "h:n"
+	};
+	uint32_t count = sizeof(tokens) / sizeof(tokens[0]);
+
+	memset(memory, 0, FLSHM_CONNECTIONS_SIZE);
+
+	// Random characters, with nulls, over the whole list.
+	if (i % 50 == 0) {
+		for (uint32_t j = 0; j < FLSHM_CONNECTIONS_SIZE - 1; j++) {
+			memory[j] = "ab:_\0c"[rand() % 6];
+		}
+		return;
+	}
+
+	// One long name, filling the list.
+	if (i % 77 == 0) {
+		for (uint32_t j = 0; j < FLSHM_CONNECTIONS_SIZE - 1; j++) {
+			memory[j] = 'a' + rand() % 3;
+		}
+		memory[5] = ':';
+		return;
+	}
+
+	// A sequence of tokens, sometimes followed by unterminated garbage.
+	uint32_t n = rand() % 14;
+	uint32_t o = 0;
+	for (uint32_t j = 0; j < n; j++) {
+		const char * token = tokens[rand() % count];
+		size_t l = strlen(token);
+		memcpy(memory + o, token, l);
+		o += l + 1;
+	}
+	if (rand() % 5 == 0) {
+		memset(memory + o, 'z', 20);
+	}
+}
+
+bool same(flshm_connected a, flshm_connected b) {
+	if (a.count != b.count) {
+		return false;
+	}
+	for (uint32_t i = 0; i < a.count; i++) {
+		flshm_connection * ca = &a.connections[i];
+		flshm_connection * cb = &b.connections[i];
+		if (
+			ca->name != cb->name ||
+			ca->version != cb->version ||
+			ca->sandbox != cb->sandbox
+		) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Compare the parsers on random lists, returns the number of mismatches.
+uint32_t test(const char * kernel, uint32_t iterations) {
+
+	// Parse from private memory, no need for the shared memory to exist.
+	char * data = calloc(1, FLSHM_SIZE);
+	flshm_info info;
+	memset(&info, 0, sizeof(info));
+	info.data = data;
+	info.index = NULL;
+	char * memory = data + FLSHM_CONNECTIONS_OFFSET;
+
+	uint32_t mismatches = 0;
+	srand(1);
+	for (uint32_t i = 0; i < iterations; i++) {
+		generate(memory, i);
+
+		// Compare with a fresh parse, then with the cached one.
+		free(info.index);
+		info.index = NULL;
+		flshm_connected expected = legacy_connection_list(&info);
+		flshm_connected parsed = flshm_connection_list(&info);
+		flshm_connected cached = flshm_connection_list(&info);
+		if (!same(expected, parsed) || !same(expected, cached)) {
+			if (!mismatches) {
+				printf(
+					"MISMATCH: %s: list %u: %u vs %u connections\n",
+					kernel,
+					i,
+					expected.count,
+					parsed.count
+				);
+			}
+			mismatches++;
+		}
+	}
+
+	free(info.index);
+	free(data);
+
+	printf("%s: %u lists, %u mismatches\n", kernel, iterations, mismatches);
+	return mismatches;
+}
+
+int main(int argc, char ** argv) {
+
+	uint32_t iterations = argc < 2 ? 100000 : (uint32_t)atol(argv[1]);
+	uint32_t mismatches = 0;
+
+#ifdef SCAN_X86
+
+	// Test each kernel the CPU supports.
+	__builtin_cpu_init();
+	flshm_scan_selected = flshm_scan_scalar;
+	mismatches += test("scalar", iterations);
+	if (__builtin_cpu_supports("sse2")) {
+		flshm_scan_selected = flshm_scan_sse2;
+		mismatches += test("sse2", iterations);
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		flshm_scan_selected = flshm_scan_avx2;
+		mismatches += test("avx2", iterations);
+	}
+
+#else
+
+	mismatches += test("scalar", iterations);
+
+#endif
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
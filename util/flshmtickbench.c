@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+	#include <sys/time.h>
+	#include <sys/sysinfo.h>
+#endif
+
+#include <flshm.h>
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+
+// The previous Linux tick, from the wall clock and uptime at the first call.
+uint32_t legacy_tick() {
+
+	uint32_t ret;
+
+	// Variables to cache across multiple calls.
+	static bool inited = false;
+	static struct timeval tvbase;
+	static uint32_t base = 0;
+
+	if (inited) {
+
+		// Get the current time.
+		struct timeval tv;
+		gettimeofday(&tv, 0);
+
+		// Calculate offset from base.
+		tv.tv_sec -= tvbase.tv_sec;
+		tv.tv_usec -= tvbase.tv_usec;
+
+		// Calculate the tick from the base.
+		ret = base + 1000 * tv.tv_sec + tv.tv_usec / 1000;
+	}
+	else {
+
+		// Get the system uptime, first time.
+		struct sysinfo si;
+		sysinfo(&si);
+
+		// Get the current time as base.
+		gettimeofday(&tvbase, 0);
+
+		// Mark initialized.
+		inited = true;
+
+		// Calculate the time base, and use it as first tick.
+		base = 1000 * si.uptime + tvbase.tv_usec / 1000 % 1000;
+		ret = base;
+	}
+
+	return ret;
+}
+
+#endif
+
+double bench(uint32_t (* tick)(), uint32_t iterations) {
+
+	// Sum the ticks so the calls cannot be optimized out.
+	volatile uint32_t sum = 0;
+	clock_t start = clock();
+	for (uint32_t i = 0; i < iterations; i++) {
+		sum += tick();
+	}
+	clock_t end = clock();
+
+	// Nanoseconds per call.
+	return (double)(end - start) * 1e9 / CLOCKS_PER_SEC / iterations;
+}
+
+int main(int argc, char ** argv) {
+
+	uint32_t iterations = argc < 2 ? 10000000 : (uint32_t)atol(argv[1]);
+
+	printf("iterations: %u\n", iterations);
+	printf(
+		"flshm_tick: %u, %.2f ns\n",
+		flshm_tick(),
+		bench(flshm_tick, iterations)
+	);
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+
+	printf(
+		"legacy_tick: %u, %.2f ns\n",
+		legacy_tick(),
+		bench(legacy_tick, iterations)
+	);
+
+#endif
+
+	return EXIT_SUCCESS;
+}